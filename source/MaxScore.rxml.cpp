@@ -29,680 +29,5704 @@
 #include "ext_dictobj.h"
 
 #include "rapidxml.hpp"
-
-// Workaround for an ancient bug that's never been fixed...
-// https://stackoverflow.com/questions/14113923/rapidxml-print-header-has-undefined-methods
-namespace rapidxml {
-    namespace internal {
-        template <class OutIt, class Ch>
-        inline OutIt print_children(OutIt out, const xml_node<Ch>* node, int flags, int indent);
-
-        template <class OutIt, class Ch>
-        inline OutIt print_attributes(OutIt out, const xml_node<Ch>* node, int flags);
-
-        template <class OutIt, class Ch>
-        inline OutIt print_data_node(OutIt out, const xml_node<Ch>* node, int flags, int indent);
-
-        template <class OutIt, class Ch>
-        inline OutIt print_cdata_node(OutIt out, const xml_node<Ch>* node, int flags, int indent);
-
-        template <class OutIt, class Ch>
-        inline OutIt print_element_node(OutIt out, const xml_node<Ch>* node, int flags, int indent);
-
-        template <class OutIt, class Ch>
-        inline OutIt print_declaration_node(OutIt out, const xml_node<Ch>* node, int flags, int indent);
-
-        template <class OutIt, class Ch>
-        inline OutIt print_comment_node(OutIt out, const xml_node<Ch>* node, int flags, int indent);
-
-        template <class OutIt, class Ch>
-        inline OutIt print_doctype_node(OutIt out, const xml_node<Ch>* node, int flags, int indent);
-
-        template <class OutIt, class Ch>
-        inline OutIt print_pi_node(OutIt out, const xml_node<Ch>* node, int flags, int indent);
-    }
-}
 #include "rapidxml_print.hpp"
+#include "rapidxml_compact.hpp"
+#include "rapidxml_arena.hpp"
+#include "musicxml_names.h"
 
 #include <assert.h>
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
 
 #define RXML_OUTLET_MAIN 0
+#define RXML_OUTLET_PROGRESS 1
+#define RXML_NOUTLETS 2
+
+// Size of buffers holding formatted numbers
+#define RXML_NUMBUF_SIZE 32
+
+// Nodes converted between checks of the time taken by a slice, see
+// rxml_slice_run()
+#define RXML_SLICE_NODES 64
+
+// Initial size of the buffer collecting the text of a document
+#define RXML_BUFSIZE 1000000
+
+// Bit of the rxml_parsefns index selecting rxml_parseranges()
+#define RXML_PARSE_RANGES 16
+
+// Number of names @parseflags accepts at once
+#define RXML_MAX_PARSEFLAGS 5
+
+// ticks per quarter note and default velocity in files from writemidi
+#define RXML_MIDI_PPQ 960
+#define RXML_MIDI_VELOCITY 80
+// first word of a file written by writeindex, "RXMLIDX1"
+#define RXML_INDEX_MAGIC 0x315844494c4d5852LL
+// Largest LCS table (in cells) diff will build when aligning the
+// children of two elements; bigger runs are matched pairwise by name.
+#define RXML_DIFF_MAXLCS (1 << 22)
+// log2 of the number of slots and buckets in the name table
+#define RXML_NAME_SLOTBITS 10
+#define RXML_NAME_BUCKETBITS 8
+// bytes in each chunk of the queue text is received through
+#define RXML_CHUNK_SIZE 65536
+// Priority classes of tasks submitted to the worker pool
+#define RXML_PRIORITY_INTERACTIVE 0
+#define RXML_PRIORITY_PREFETCH 1
+#define RXML_NPRIORITIES 2
+// Steps of a diff
+#define RXML_DIFF_COMPARE 0
+#define RXML_DIFF_REMOVE 1
+#define RXML_DIFF_INSERT 2
 
 void *rxml_class;
 
-t_symbol *ps_dictionary, *ps_0, *ps_ordering, *ps_text;
+t_symbol *ps_dictionary, *ps_0, *ps_ordering, *ps_text, *ps_comment;
+t_symbol *ps_lines, *ps_string, *ps_xml, *ps_json, *ps_writejson,
+    *ps_writemidi;
+t_symbol *ps_notes, *ps_part, *ps_measure, *ps_voice, *ps_step, *ps_alter,
+    *ps_octave, *ps_duration, *ps_tie, *ps_onset;
+t_symbol *ps_asis, *ps_partwise, *ps_timewise;
+t_symbol *ps_timeindex, *ps_note, *ps_measures, *ps_locate, *ps_bar;
+t_symbol *ps_diff, *ps_insert, *ps_remove, *ps_value, *ps_attr,
+    *ps_removeattr, *ps_done;
+t_symbol *ps_allocstats;
 
 using namespace rapidxml;
 
-typedef struct _rxml
+static uint64_t rxml_hashbytes(uint64_t h, const char *p, size_t n)
 {
-	t_object ob;
-    void *outlets[1];
-    t_critical lock;
-    char *buf;
-    size_t buflen, bufpos;
-} rxml;
+    // FNV-1a
+    for(size_t i = 0; i < n; ++i)
+    {
+        h ^= (unsigned char)p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
 
-#ifdef RAPIDXML_NO_EXCEPTIONS
-void rapidxml::parse_error_handler(const char *what, void *where)
+// Hashes the length of a range and then its bytes, so that adjacent
+// ranges can't run into each other
+static uint64_t rxml_hashrange(uint64_t h, const char *p, size_t n)
 {
-    std::cout << "Parse error: " << what << "\n";
-    // this function must not return
-    std::abort();
+    const uint64_t len = n;
+    h = rxml_hashbytes(h, (const char *)&len, sizeof(len));
+    return rxml_hashbytes(h, p, n);
 }
-#endif
 
-extern "C" {
-static void clearbuf(rxml *x);
+// Appends the UTF-8 encoding of code point c to out
+static void rxml_pututf8(std::string &out, unsigned long c)
+{
+    if(c < 0x80)
+    {
+        out += (char)c;
+    }
+    else if(c < 0x800)
+    {
+        out += (char)(0xC0 | (c >> 6));
+        out += (char)(0x80 | (c & 0x3F));
+    }
+    else if(c < 0x10000)
+    {
+        out += (char)(0xE0 | (c >> 12));
+        out += (char)(0x80 | ((c >> 6) & 0x3F));
+        out += (char)(0x80 | (c & 0x3F));
+    }
+    else
+    {
+        out += (char)(0xF0 | (c >> 18));
+        out += (char)(0x80 | ((c >> 12) & 0x3F));
+        out += (char)(0x80 | ((c >> 6) & 0x3F));
+        out += (char)(0x80 | (c & 0x3F));
+    }
+}
 
-static void rxml_anything(rxml *x,
-                          const t_symbol * const s,
-                          const long ac, const t_atom *av)
+// Appends the n characters at s to out, translating the predefined
+// entities and character references as the parser would have. Anything
+// else that starts with & is copied unchanged.
+static void rxml_decode(std::string &out, const char *s, size_t n)
 {
-    assert(x);
-    assert(s);
-    const char * const str = s->s_name;
-    assert(str);
-    const size_t len = strlen(str);
-    critical_enter(x->lock);
-    size_t buflen = x->buflen;
-    size_t bufpos = x->bufpos;
-    critical_exit(x->lock);
-    if(len + bufpos >= buflen)
+    static const struct
     {
-        buflen += 250000;
-        critical_enter(x->lock);
-        char *buf = (char *)realloc(x->buf, buflen);
-        if(!buf)
+        const char *name;
+        size_t len;
+        char c;
+    } entities[] = {
+        { "amp;", 4, '&' }, { "lt;", 3, '<' }, { "gt;", 3, '>' },
+        { "quot;", 5, '"' }, { "apos;", 5, '\'' }
+    };
+    const char * const end = s + n;
+    while(s < end)
+    {
+        const char *amp = (const char *)memchr(s, '&', end - s);
+        if(!amp)
         {
-            object_error((t_object *)x, "Out of memory!\n");
-            x->buf = NULL;
-            x->buflen = 0;
-            x->bufpos = 0;
-            critical_exit(x->lock);
+            out.append(s, end - s);
             return;
         }
-        x->buflen = buflen;
-        x->buf = buf;
-        critical_exit(x->lock);
+        out.append(s, amp - s);
+        s = amp + 1;
+        bool done = false;
+        if(s < end && *s == '#')
+        {
+            const bool hex = s + 1 < end && s[1] == 'x';
+            const char *p = s + 1 + hex;
+            unsigned long c = 0;
+            const char * const digits = p;
+            for(; p < end && isxdigit((unsigned char)*p)
+                    && (hex || isdigit((unsigned char)*p))
+                    && c <= 0x10FFFF; ++p)
+            {
+                const int d = isdigit((unsigned char)*p)
+                    ? *p - '0' : (tolower((unsigned char)*p) - 'a' + 10);
+                c = c * (hex ? 16 : 10) + d;
+            }
+            if(p > digits && p < end && *p == ';' && c <= 0x10FFFF)
+            {
+                rxml_pututf8(out, c);
+                s = p + 1;
+                done = true;
+            }
+        }
+        for(size_t i = 0; !done && i < sizeof(entities) / sizeof(entities[0]);
+            ++i)
+        {
+            if((size_t)(end - s) >= entities[i].len
+               && !memcmp(s, entities[i].name, entities[i].len))
+            {
+                out += entities[i].c;
+                s += entities[i].len;
+                done = true;
+            }
+        }
+        if(!done)
+        {
+            out += '&';
+        }
     }
-    critical_enter(x->lock);
-    memcpy(x->buf + bufpos, str, len);
-    x->bufpos += len;
-    critical_exit(x->lock);
-
-    
 }
 
-static void rxml_outputXML(const rxml * const x,
-                           const xml_document<> * const doc)
+// Terminated copy of a name or value from a document parsed by
+// rxml_parseranges(), with entities translated if decode is set and
+// there are any. Short text without entities stays on the stack.
+struct rxml_cstr
 {
-    std::string s;
-    print(std::back_inserter(s), *doc, 0);
-    std::istringstream iss(s);
-    std::string nl;
-    while(std::getline(iss, nl, '\n'))
+    rxml_cstr(const char *s, size_t n, bool decode)
     {
-        // std::cout << nl << "\n";
-        // object_post((t_object *)x, "len = %d", nl.length());
-        if(nl.length() == 0)
+        if(decode && memchr(s, '&', n))
         {
-            continue;
+            rxml_decode(heap, s, n);
+            str = heap.c_str();
+            size = heap.size();
+        }
+        else if(n < sizeof(local))
+        {
+            memcpy(local, s, n);
+            local[n] = 0;
+            str = local;
+            size = n;
+        }
+        else
+        {
+            heap.assign(s, n);
+            str = heap.c_str();
+            size = n;
         }
-        t_symbol *s = gensym(nl.c_str());
-        outlet_anything(x->outlets[RXML_OUTLET_MAIN], s, 0, NULL);
     }
+
+    const char *str;
+    size_t size;
+
+private:
+    char local[128];
+    std::string heap;
+    rxml_cstr(const rxml_cstr &);
+    void operator=(const rxml_cstr &);
+};
+
+// Perfect hash of the MusicXML vocabulary (hash and displace): a name
+// selects a bucket by its hash, and the bucket's displacement sends it
+// to a slot holding its id, so a lookup is one hash, one probe and one
+// comparison. The table and the symbols of every name, and of every
+// name with "@" in front for attributes, are made in rxml_names_init().
+static uint16_t rxml_name_slots[1 << RXML_NAME_SLOTBITS];  // id + 1
+static uint16_t rxml_name_disp[1 << RXML_NAME_BUCKETBITS];
+static size_t rxml_name_sizes[RXML_NNAMES];
+static t_symbol *rxml_name_syms[RXML_NNAMES];
+static t_symbol *rxml_name_atsyms[RXML_NNAMES];
+
+static uint64_t rxml_namehash(const char *s, size_t n)
+{
+    return rxml_hashbytes(0xcbf29ce484222325ULL, s, n);
 }
 
-static xml_node<> *rxml_toXML(const rxml *x,
-                              xml_document<> *doc,
-                              const char * const elem,
-                              const t_dictionary * const d);
+static size_t rxml_nameslot(uint64_t h, uint16_t disp)
+{
+    h ^= disp * 0x9e3779b97f4a7c15ULL;
+    h *= 0xff51afd7ed558ccdULL;
+    return (size_t)(h >> (64 - RXML_NAME_SLOTBITS));
+}
 
-static xml_node<> *rxml_toXML_entry(const rxml *x,
-                                    xml_document<> *doc,
-                                    const t_dictionary * const d,
-                                    const char * const elem,
-                                    const long nkeys,
-                                    const t_symbol * const *keys,
-                                    const long nordering,
-                                    const t_atom * const ordering)
+static void rxml_names_init(void)
 {
-    assert(x);
-    assert(doc);
-    assert(d);
-    assert(elem);
-    //assert(keys);
-    xml_node<> *node = doc->allocate_node(node_element, elem);
-    if(nkeys && keys)
+    const size_t nbuckets = 1 << RXML_NAME_BUCKETBITS;
+    std::vector<std::vector<long> > buckets(nbuckets);
+    std::vector<uint64_t> hashes(RXML_NNAMES);
+    for(long i = 0; i < RXML_NNAMES; ++i)
+    {
+        const char * const name = rxml_musicxml_names[i];
+        const size_t n = strlen(name);
+        rxml_name_sizes[i] = n;
+        hashes[i] = rxml_namehash(name, n);
+        buckets[hashes[i] & (nbuckets - 1)].push_back(i);
+        rxml_name_syms[i] = gensym(name);
+        std::string at = std::string("@") + name;
+        rxml_name_atsyms[i] = gensym(at.c_str());
+    }
+    // place the largest buckets first, while most slots are free
+    std::vector<std::pair<size_t, size_t> > order(nbuckets);
+    for(size_t b = 0; b < nbuckets; ++b)
+    {
+        order[b] = std::make_pair(buckets[b].size(), b);
+    }
+    std::sort(order.rbegin(), order.rend());
+    std::vector<size_t> slots;
+    for(size_t o = 0; o < nbuckets; ++o)
     {
-        // attributes
-        for(long i = 0; i < nkeys; ++i)
+        const std::vector<long> &bucket = buckets[order[o].second];
+        if(bucket.empty())
+        {
+            break;
+        }
+        for(uint16_t d = 0; ; ++d)
         {
-            if(keys[i]->s_name && keys[i]->s_name[0] == '@')
+            slots.clear();
+            for(size_t i = 0; i < bucket.size(); ++i)
             {
-                t_atom *vals = NULL;
-                long nvals = 0;
-                t_max_err e = dictionary_getatoms(d, (t_symbol *)keys[i], &nvals, &vals);
-                if(e)
+                const size_t slot = rxml_nameslot(hashes[bucket[i]], d);
+                if(rxml_name_slots[slot]
+                   || std::find(slots.begin(), slots.end(), slot)
+                   != slots.end())
                 {
-                    object_error((t_object *)x,
-                                 "dictionary_getatom() produced "
-                                 "an error: %d",
-                                 e);
-                    return NULL;
+                    break;
                 }
+                slots.push_back(slot);
+            }
+            if(slots.size() == bucket.size())
+            {
+                for(size_t i = 0; i < bucket.size(); ++i)
                 {
-                    char *str = NULL;
-                    long str_len = 0;
-                    t_max_err e = atom_gettext(nvals, vals, &str_len, &str, 0);
-                    if(e)
-                    {
-                        object_error((t_object *)x,
-                                     "encountered an error while "
-                                     "converting atoms to string");
-                        return NULL;
-                    }
-                    if(!str || str_len == 0)
-                    {
-                        object_error((t_object *)x,
-                                     "couldn't convert atoms to string");
-                        return NULL;
-                    }
-                    xml_attribute<> *attr =
-                        doc->allocate_attribute(keys[i]->s_name + 1,
-                                                doc->allocate_string(str));
-                    node->append_attribute(attr);
-                    if(str)
-                    {
-                        sysmem_freeptr(str);
-                    }
+                    rxml_name_slots[slots[i]] = (uint16_t)(bucket[i] + 1);
                 }
+                rxml_name_disp[order[o].second] = d;
+                break;
             }
-            else
+            // a table this sparse always has room, so this cannot wrap
+            assert(d != 0xffff);
+        }
+    }
+}
+
+// Returns the id of the n characters at s in rxml_musicxml_names, or
+// -1 if they are not a MusicXML name.
+static long rxml_nameid(const char *s, size_t n)
+{
+    const uint64_t h = rxml_namehash(s, n);
+    const uint16_t d = rxml_name_disp[h & ((1 << RXML_NAME_BUCKETBITS) - 1)];
+    const long id = (long)rxml_name_slots[rxml_nameslot(h, d)] - 1;
+    if(id >= 0 && rxml_name_sizes[id] == n
+       && !memcmp(rxml_musicxml_names[id], s, n))
+    {
+        return id;
+    }
+    return -1;
+}
+
+// Symbol for the name of n characters at s
+static t_symbol *rxml_namesym(const char *s, size_t n)
+{
+    const long id = rxml_nameid(s, n);
+    if(id >= 0)
+    {
+        return rxml_name_syms[id];
+    }
+    const rxml_cstr name(s, n, false);
+    return gensym(name.str);
+}
+
+// Symbol for the dict key of attribute s, "@" followed by its name.
+static t_symbol *rxml_attrsym(const char *s, size_t n)
+{
+    const long id = rxml_nameid(s, n);
+    if(id >= 0)
+    {
+        return rxml_name_atsyms[id];
+    }
+    // char key[n + 2];
+    char* key = (char*)alloca(n + 2);
+    key[0] = '@';
+    memcpy(key + 1, s, n);
+    key[n + 1] = 0;
+    return gensym(key);
+}
+
+// Work shared by all instances runs on one pool of threads, created in
+// ext_main with one worker per core. Each worker keeps a deque per
+// priority class, taking its own tasks from the back and stealing
+// others' from the front; tasks submitted from other threads (the main
+// thread and the scheduler) go to a shared queue. Interactive tasks,
+// which a message is waiting on, are always taken before prefetch ones.
+typedef void (*rxml_taskfn)(void *arg);
+
+// Tasks submitted with a group can be waited for together
+struct rxml_taskgroup
+{
+    std::atomic<long> pending;
+    std::mutex lock;
+    std::condition_variable done;
+    rxml_taskgroup(): pending(0) {}
+};
+
+struct rxml_task
+{
+    rxml_taskfn fn;
+    void *arg;
+    rxml_taskgroup *group;
+};
+
+struct rxml_worker
+{
+    std::mutex lock;
+    std::deque<rxml_task> tasks[RXML_NPRIORITIES];
+    std::thread thread;
+};
+
+struct rxml_pool
+{
+    std::vector<rxml_worker *> workers;
+    // guards queue and stop; idle workers wait on wake
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<rxml_task> queue[RXML_NPRIORITIES];
+    // tasks in all deques and the queue
+    std::atomic<long> queued;
+    bool stop;
+};
+
+static rxml_pool *rxml_workers = NULL;
+// index of the worker running on this thread, -1 on other threads
+static thread_local long rxml_workerid = -1;
+
+// Takes the next task of at most the given priority class, looking in
+// the worker's own deque, then the shared queue, then the other
+// workers' deques. Returns false if there is none.
+static bool rxml_pool_take(rxml_pool *pool, long self, int maxpriority,
+                           rxml_task *t)
+{
+    const long n = (long)pool->workers.size();
+    for(int p = 0; p <= maxpriority; ++p)
+    {
+        if(self >= 0)
+        {
+            rxml_worker *w = pool->workers[self];
+            std::lock_guard<std::mutex> g(w->lock);
+            if(!w->tasks[p].empty())
             {
-                // assert(0);
+                *t = w->tasks[p].back();
+                w->tasks[p].pop_back();
+                --pool->queued;
+                return true;
             }
         }
-        // children
-        if(nordering)
         {
-            t_hashtab *ht = hashtab_new(0);
-            for(long i = 0; i < nordering; ++i)
+            std::lock_guard<std::mutex> g(pool->lock);
+            if(!pool->queue[p].empty())
             {
-                if(!dictionary_hasentry(d, atom_getsym(ordering + i)))
-                {
-                    object_error((t_object *)x,
-                                 "found a symbol in .ordering that "
-                                 "isn't in the dictionary");
-                    return node;
-                }
-                t_atom val;
-                t_max_err e = dictionary_getatom(d,
-                                                 atom_getsym(ordering + i),
-                                                 &val);
-                if(e)
-                {
-                    object_error((t_object *)x,
-                                 "dictionary_getatom() produced "
-                                 "an error: %d",
-                                 e);
-                    return NULL;
-                }
-                if(atom_gettype(&val) == A_OBJ)
-                {
-                    t_atom_long count;
-                    hashtab_lookuplong(ht, atom_getsym(ordering + i), &count);
-                    char buf[16];
-                    snprintf(buf, 16, "%ld", count);
-                    hashtab_storelong(ht, atom_getsym(ordering + i), count + 1);
-                    t_atom idxa;
-                    dictionary_getatom((t_dictionary *)atom_getobj(&val),
-                                       gensym(buf),
-                                       &idxa);
-                    if(atom_gettype(&idxa) != A_OBJ)
-                    {
-                        object_error((t_object *)x,
-                                     "found something other than a dict.");
-                        return NULL;                        
-                    }
-                    xml_node<> *nn =
-                        rxml_toXML(x, doc, atom_getsym(ordering + i)->s_name,
-                                   (t_dictionary *)atom_getobj(&idxa));
-                    // (t_dictionary *)atom_getobj(&val));
-                    node->append_node(nn);
-                }
-                else
-                {
-                    if(atom_gettype(&val) != A_SYM)
-                    {
-                        object_error((t_object *)x,
-                                     "found an entry that is "
-                                     "not a string");
-                        return node;
-                    }
-                    xml_node<> *nn =
-                        doc->allocate_node(node_element,
-                                           atom_getsym(ordering + i)->s_name,
-                                           atom_getsym(&val)->s_name);
-                    node->append_node(nn);
-                }
+                *t = pool->queue[p].front();
+                pool->queue[p].pop_front();
+                --pool->queued;
+                return true;
             }
-            object_free((t_object *)ht);
         }
-        else
+        for(long i = 1; i <= n; ++i)
         {
-            for(long i = 0; i < nkeys; ++i)
+            rxml_worker *w = pool->workers[(self + i + n) % n];
+            std::lock_guard<std::mutex> g(w->lock);
+            if(!w->tasks[p].empty())
             {
-                if(keys[i]->s_name && keys[i]->s_name[0] != '@'
-                   && strcmp(keys[i]->s_name, ".ordering"))
-                {
-                    t_atom val;
-                    t_max_err e =
-                        dictionary_getatom(d, (t_symbol *)keys[i], &val);
-                    if(e)
-                    {
-                        object_error((t_object *)x,
-                                     "dictionary_getatom() produced "
-                                     "an error: %d",
-                                     e);
-                        return NULL;
-                    }
+                *t = w->tasks[p].front();
+                w->tasks[p].pop_front();
+                --pool->queued;
+                return true;
+            }
+        }
+    }
+    return false;
+}
 
-                    if(atom_gettype(&val) == A_OBJ)
-                    {
-                        xml_node<> *nn =
-                            rxml_toXML(x, doc, elem,//keys[i]->s_name,
-                                       (t_dictionary *)atom_getobj(&val));
-                        node->append_node(nn);
-                    }
-                    else
-                    {
-                        // This is a data node
-                        if(atom_gettype(&val) != A_SYM)
-                        {
-                            object_error((t_object *)x,
-                                         "found an entry that is "
-                                         "not a string");
-                            return node;
-                        }
-                        xml_node<> *nn =
-                            doc->allocate_node(node_data,
-                                               keys[i]->s_name,
-                                               atom_getsym(&val)->s_name);
-                        node->append_node(nn);
-                    }
+static void rxml_task_run(const rxml_task &t)
+{
+    t.fn(t.arg);
+    std::lock_guard<std::mutex> g(t.group->lock);
+    if(--t.group->pending == 0)
+    {
+        t.group->done.notify_all();
+    }
+}
 
-                }
-                else
-                {
-                    // assert(0);
-                }
-            }
+static void rxml_worker_main(rxml_pool *pool, long self)
+{
+    rxml_workerid = self;
+    for(;;)
+    {
+        rxml_task t;
+        if(rxml_pool_take(pool, self, RXML_NPRIORITIES - 1, &t))
+        {
+            rxml_task_run(t);
+            continue;
+        }
+        std::unique_lock<std::mutex> g(pool->lock);
+        while(!pool->stop && pool->queued <= 0)
+        {
+            pool->wake.wait(g);
+        }
+        if(pool->stop)
+        {
+            return;
         }
-        return node;
     }
-    else
+}
+
+static rxml_pool *rxml_pool_new(long nworkers)
+{
+    rxml_pool *pool = new rxml_pool;
+    pool->queued = 0;
+    pool->stop = false;
+    for(long i = 0; i < nworkers; ++i)
     {
-        // assert(0);
+        pool->workers.push_back(new rxml_worker);
     }
-    return node;
+    for(long i = 0; i < nworkers; ++i)
+    {
+        pool->workers[i]->thread = std::thread(rxml_worker_main, pool, i);
+    }
+    return pool;
 }
 
-static xml_node<> *rxml_toXML(const rxml *x,
-                              xml_document<> *doc,
-                              const char * const elem,
-                              const t_dictionary * const d)
+// Stops the workers once they run out of tasks, then runs any tasks
+// still queued on this thread, so that every group is counted down and
+// every argument freed; tasks submitted from here on run at once.
+// Installed as a quit task by ext_main.
+static void rxml_pool_free(void *)
 {
-    assert(x);
-    assert(doc);
-    assert(elem);
-    assert(d);
-    t_symbol **keys = NULL;
-    long nkeys = 0;
-    t_atom *ordering = NULL;
-    long nordering = 0;
-    if(dictionary_hasentry(d, ps_ordering))
+    rxml_pool * const pool = rxml_workers;
+    if(!pool)
     {
-        dictionary_getatoms(d, ps_ordering, &nordering, &ordering);
+        return;
     }
-    dictionary_getkeys(d, &nkeys, &keys);
-    xml_node<> *n = rxml_toXML_entry(x, doc, d, elem, nkeys, keys,
-                                     nordering, ordering);
-    if(keys)
     {
-        sysmem_freeptr(keys);
+        std::lock_guard<std::mutex> g(pool->lock);
+        pool->stop = true;
     }
-    return n;
+    pool->wake.notify_all();
+    for(size_t i = 0; i < pool->workers.size(); ++i)
+    {
+        pool->workers[i]->thread.join();
+    }
+    rxml_task t;
+    while(rxml_pool_take(pool, -1, RXML_NPRIORITIES - 1, &t))
+    {
+        rxml_task_run(t);
+    }
+    rxml_workers = NULL;
+    for(size_t i = 0; i < pool->workers.size(); ++i)
+    {
+        delete pool->workers[i];
+    }
+    delete pool;
 }
 
-static void rxml_dictionary(rxml *x, const t_symbol * const s)
+// Number of tasks that can run at once: the workers, and the thread
+// waiting for them
+static long rxml_pool_size(void)
 {
-    assert(x);
-    assert(s);
-    xml_document<> doc;
-    xml_node<> *node = NULL;
-    t_dictionary *d = dictobj_findregistered_retain((t_symbol *)s);
-    if(!d)
+    return rxml_workers ? (long)rxml_workers->workers.size() + 1 : 1;
+}
+
+// Submits fn(arg) to the pool with the given priority class. Without a
+// pool, or from outside it once it is stopping, fn runs at once.
+static void rxml_pool_submit(int priority, rxml_taskfn fn, void *arg,
+                             rxml_taskgroup *group)
+{
+    rxml_pool * const pool = rxml_workers;
+    const rxml_task t = {fn, arg, group};
+    ++group->pending;
+    if(!pool)
     {
-        object_error((t_object *)x, "Couldn't find dictionary %s",
-                     s->s_name);
+        rxml_task_run(t);
         return;
     }
+    if(rxml_workerid >= 0)
     {
-        t_max_err e = MAX_ERR_NONE;
-        t_symbol **keys = NULL;
-        long nkeys = 0;
-        t_atom val;
-        e = dictionary_getkeys(d, &nkeys, &keys);
-        if(e != MAX_ERR_NONE)
+        // taken by this worker before it stops, if no other does
+        rxml_worker *w = pool->workers[rxml_workerid];
+        std::lock_guard<std::mutex> g(w->lock);
+        w->tasks[priority].push_back(t);
+    }
+    bool stopped;
+    {
+        // counted under the pool's lock so that no worker misses it
+        // between looking and going to sleep
+        std::lock_guard<std::mutex> g(pool->lock);
+        stopped = pool->stop && rxml_workerid < 0;
+        if(!stopped)
         {
-            object_error((t_object *)x,
-                         "dictionary_getkeys() returned an error: %d",
-                         e);
-            goto cleanup;
+            if(rxml_workerid < 0)
+            {
+                pool->queue[priority].push_back(t);
+            }
+            ++pool->queued;
         }
-        if(!nkeys || !keys)
+    }
+    if(stopped)
+    {
+        // no worker would take it
+        rxml_task_run(t);
+        return;
+    }
+    pool->wake.notify_one();
+}
+
+// Takes the task a worker submitted last, of any priority class
+static bool rxml_pool_takeown(rxml_pool *pool, long self, rxml_task *t)
+{
+    rxml_worker *w = pool->workers[self];
+    std::lock_guard<std::mutex> g(w->lock);
+    for(int p = 0; p < RXML_NPRIORITIES; ++p)
+    {
+        if(!w->tasks[p].empty())
         {
-            object_error((t_object *)x, "dictionary is empty");
-            goto cleanup;
+            *t = w->tasks[p].back();
+            w->tasks[p].pop_back();
+            --pool->queued;
+            return true;
         }
-        if(nkeys > 1)
+    }
+    return false;
+}
+
+// Waits for the tasks of group, running interactive tasks meanwhile
+// rather than idling. A worker also runs the tasks it submitted itself,
+// which may be the ones it is waiting for, so that workers waiting
+// inside tasks cannot all block.
+static void rxml_taskgroup_wait(rxml_taskgroup *group)
+{
+    rxml_pool * const pool = rxml_workers;
+    rxml_task t;
+    while(group->pending > 0)
+    {
+        if(pool && (rxml_pool_take(pool, rxml_workerid,
+                                   RXML_PRIORITY_INTERACTIVE, &t)
+                    || (rxml_workerid >= 0
+                        && rxml_pool_takeown(pool, rxml_workerid, &t))))
+        {
+            rxml_task_run(t);
+            continue;
+        }
+        std::unique_lock<std::mutex> g(group->lock);
+        while(group->pending > 0)
+        {
+            group->done.wait(g);
+        }
+    }
+    // the last task counts down under the lock, so once it is taken
+    // here that task no longer uses group
+    std::lock_guard<std::mutex> g(group->lock);
+}
+
+// Text received by rxml_anything() travels to the thread processing it
+// through a queue of chunks with one producer and one consumer, without
+// locks: the producer copies each message into the last chunk and
+// publishes its new length, linking a new chunk when it is full, and
+// the consumer reads what is published, moving past chunks once a next
+// one is linked. Chunks the consumer has passed are recycled by the
+// producer. Text can come from the main and the scheduler thread at
+// once, so producers take the instance's writelock, which the consumer
+// never does; the consumer side runs under the instance's lock.
+struct rxml_chunk
+{
+    std::atomic<rxml_chunk *> next;
+    // bytes of data written so far
+    std::atomic<size_t> len;
+    size_t size;
+    char data[1];
+};
+
+struct rxml_ingest
+{
+    // consumer: the chunk being read, and how much of it has been
+    std::atomic<rxml_chunk *> head;
+    size_t headpos;
+    // producer: the chunk being written, the oldest chunk, which can be
+    // reused once it is not head, and the last head seen
+    rxml_chunk *tail;
+    rxml_chunk *first;
+    rxml_chunk *headcopy;
+};
+
+static rxml_chunk *rxml_chunk_new(size_t size)
+{
+    size = std::max(size, (size_t)RXML_CHUNK_SIZE);
+    void *mem = malloc(offsetof(rxml_chunk, data) + size);
+    if(!mem)
+    {
+        return NULL;
+    }
+    rxml_chunk *c = new (mem) rxml_chunk;
+    c->next.store(NULL, std::memory_order_relaxed);
+    c->len.store(0, std::memory_order_relaxed);
+    c->size = size;
+    return c;
+}
+
+static rxml_ingest *rxml_ingest_new(void)
+{
+    rxml_chunk * const c = rxml_chunk_new(0);
+    if(!c)
+    {
+        return NULL;
+    }
+    rxml_ingest *q = new rxml_ingest;
+    q->head.store(c, std::memory_order_relaxed);
+    q->headpos = 0;
+    q->tail = q->first = q->headcopy = c;
+    return q;
+}
+
+static void rxml_ingest_free(rxml_ingest *q)
+{
+    for(rxml_chunk *c = q->first, *next; c; c = next)
+    {
+        next = c->next.load(std::memory_order_relaxed);
+        free(c);
+    }
+    delete q;
+}
+
+// Producer: gets an empty chunk of at least size bytes, reusing one the
+// consumer is done with if there is one
+static rxml_chunk *rxml_ingest_chunk(rxml_ingest *q, size_t size)
+{
+    for(;;)
+    {
+        if(q->first == q->headcopy)
+        {
+            q->headcopy = q->head.load(std::memory_order_acquire);
+            if(q->first == q->headcopy)
+            {
+                return rxml_chunk_new(size);
+            }
+        }
+        rxml_chunk * const c = q->first;
+        q->first = c->next.load(std::memory_order_relaxed);
+        if(c->size >= size)
+        {
+            c->next.store(NULL, std::memory_order_relaxed);
+            c->len.store(0, std::memory_order_relaxed);
+            return c;
+        }
+        free(c);
+    }
+}
+
+// Producer: appends n bytes. Returns 1 if a chunk couldn't be allocated.
+static int rxml_ingest_write(rxml_ingest *q, const char *s, size_t n)
+{
+    rxml_chunk *t = q->tail;
+    size_t pos = t->len.load(std::memory_order_relaxed);
+    if(pos + n > t->size)
+    {
+        rxml_chunk * const c = rxml_ingest_chunk(q, n);
+        if(!c)
+        {
+            return 1;
+        }
+        t->next.store(c, std::memory_order_release);
+        q->tail = t = c;
+        pos = 0;
+    }
+    memcpy(t->data + pos, s, n);
+    t->len.store(pos + n, std::memory_order_release);
+    return 0;
+}
+
+// Consumer: passes each published run of text not yet read to
+// fn(arg, s, n), in order
+template<class Fn>
+static void rxml_ingest_read(rxml_ingest *q, Fn fn, void *arg)
+{
+    rxml_chunk *c = q->head.load(std::memory_order_relaxed);
+    for(;;)
+    {
+        const size_t len = c->len.load(std::memory_order_acquire);
+        if(len > q->headpos)
+        {
+            fn(arg, c->data + q->headpos, len - q->headpos);
+            q->headpos = len;
+        }
+        rxml_chunk * const next = c->next.load(std::memory_order_acquire);
+        if(!next)
+        {
+            return;
+        }
+        // the producer wrote c for the last time before linking next
+        const size_t last = c->len.load(std::memory_order_acquire);
+        if(last > q->headpos)
+        {
+            fn(arg, c->data + q->headpos, last - q->headpos);
+        }
+        c = next;
+        q->headpos = 0;
+        q->head.store(c, std::memory_order_release);
+    }
+}
+
+// Running musical position while walking a partwise score, following
+// MusicXML's <divisions>, <backup>, <forward> and <chord/> semantics.
+// Positions and durations are in quarter notes.
+struct rxml_cursor
+{
+    long part;          // index of the current <part>
+    long measure;       // index of the current <measure> in the part
+    double divisions;   // divisions per quarter note
+    double pos;         // current position
+    double maxpos;      // furthest position reached in the part
+    double lastonset;   // onset of the previous note, for chords
+    long note;          // index of the current <note> in the measure
+};
+
+// A <note> or the start of a <measure> in the time index. note is the
+// index of the note among the <note> elements of its measure, and -1
+// for a measure start.
+struct rxml_event
+{
+    double onset;
+    long part;
+    long measure;
+    long note;
+};
+
+static bool rxml_event_before(const rxml_event &a, const rxml_event &b)
+{
+    return a.onset < b.onset;
+}
+
+// Index of the measure starts of a score, searched by locate and bar
+struct rxml_timeindex
+{
+    // measure starts in document order, so sorted by part and measure,
+    // and by onset within each part
+    std::vector<rxml_event> measures;
+    // index in measures of the first measure of each part, followed by
+    // measures.size(), so that part i has [parts[i], parts[i + 1])
+    std::vector<size_t> parts;
+};
+
+// Columns of the note table output by notetable and @notes, one row per
+// <note> in document order
+struct rxml_notetable
+{
+    rxml_cursor cursor;
+    std::vector<t_atom> part, measure, voice, step, alter, octave,
+        duration, tie, onset;
+    // the notes for the time index, in document order
+    std::vector<rxml_event> events;
+    rxml_timeindex times;
+};
+
+// Byte offsets of an element in the source text: start is the '<' of
+// the start tag, head is just past its '>', and end is just past the
+// '>' of the end tag
+struct rxml_range
+{
+    size_t start;
+    size_t head;
+    size_t end;
+};
+
+struct rxml_partrange
+{
+    rxml_range part;
+    std::vector<rxml_range> measures;
+};
+
+// Offsets of the root, <part> and <measure> elements of a partwise
+// score, used by parsemeasures to parse only some measures
+struct rxml_measureindex
+{
+    size_t srclen;
+    rxml_range root;
+    std::vector<rxml_partrange> parts;
+};
+
+// A MIDI event in a track being built by writemidi. bytes holds the
+// complete event, status byte first; order sorts simultaneous events
+// so that meta events come first and note offs precede note ons.
+struct rxml_midievent
+{
+    long tick;
+    int order;
+    unsigned char nbytes;
+    unsigned char bytes[7];
+};
+
+static bool rxml_midievent_before(const rxml_midievent &a,
+                                  const rxml_midievent &b)
+{
+    return a.tick < b.tick || (a.tick == b.tick && a.order < b.order);
+}
+
+struct rxml_slicejob;
+
+typedef struct _rxml
+{
+	t_object ob;
+    void *outlets[RXML_NOUTLETS];
+    t_critical lock;
+    // text received by rxml_anything() on its way to buf, written
+    // under writelock so that one thread at a time produces
+    t_critical writelock;
+    rxml_ingest *ingest;
+    // text taken from ingest so far, terminated, guarded by lock
+    char *buf;
+    size_t buflen, bufpos;
+    // how generated XML is delivered: lines or string
+    t_symbol *output;
+    // holds the XML string when output is "string"
+    t_dictionary *xmldict;
+    t_symbol *xmldictname;
+    // store numeric text as longs and floats
+    char typed;
+    // also output the note table when converting to a dict
+    char notes;
+    rxml_notetable *notetable;
+    t_dictionary *notesdict;
+    t_symbol *notesdictname;
+    // keep a time index when converting, for locate and bar
+    char timeindex;
+    rxml_timeindex *times;
+    t_dictionary *timesdict;
+    t_symbol *timesdictname;
+    // offsets of the parts and measures, for parsemeasures
+    rxml_measureindex *mindex;
+    // holds the string output by json
+    t_dictionary *jsondict;
+    t_symbol *jsondictname;
+    // partwise, timewise, or asis to leave scores as they are
+    t_symbol *orientation;
+    // convert from a compact_document rather than the DOM
+    char compact;
+    // export dicts with rxml_stream() rather than through a document
+    char stream;
+    // threads exporting the children of the root, 0 for all of the
+    // worker pool, see rxml_stream_parallel()
+    long threads;
+    // background tasks using this instance, waited for when it is freed
+    rxml_taskgroup *tasks;
+    // milliseconds a slice of a conversion to a dict may take, 0 to
+    // convert in one go, see rxml_slice_run()
+    double slice;
+    t_qelem sliceq;
+    rxml_slicejob *slicejob;
+    // text taken by a bang for sliceq to parse, under lock
+    char *slicebuf;
+    // index into rxml_parsefns, see rxml_parseflags_set()
+    long parseflags;
+    t_symbol *parseflagsyms[RXML_MAX_PARSEFLAGS];
+    long nparseflagsyms;
+    // memory taken by the pools of documents parsed by this instance,
+    // counted from the start of the last parse, see rxml_allocstats()
+    tracked_arena *arena;
+    // reference document for diff
+    xml_document<> *diffdoc;
+    char *diffbuf;
+    // holds the XML of each subtree inserted by a diff
+    t_dictionary *diffdict;
+    t_symbol *diffdictname;
+} rxml;
+
+// Parsers for every combination of the flags @parseflags can select,
+// instantiated up front so parsing stays fully specialized. Bits of
+// the index: 1 noentity, 2 trim, 4 normalize, 8 comments, and
+// RXML_PARSE_RANGES for a non-destructive parse. Attributes are always
+// stored contiguously, see rxml_toJSON_attributes().
+typedef void (*rxml_parsefn)(xml_document<> *doc, char *buf);
+
+template<int Flags>
+static void rxml_parse_with(xml_document<> *doc, char *buf)
+{
+    doc->parse<Flags | parse_contiguous_attributes>(buf);
+}
+
+#define RXML_PARSEFN(i)                                                 \
+    &rxml_parse_with<((i) & 1 ? parse_no_entity_translation : 0)       \
+                     | ((i) & 2 ? parse_trim_whitespace : 0)           \
+                     | ((i) & 4 ? parse_normalize_whitespace : 0)      \
+                     | ((i) & 8 ? parse_comment_nodes : 0)           \
+                     | ((i) & RXML_PARSE_RANGES                         \
+                        ? parse_non_destructive : 0)>
+
+static const rxml_parsefn rxml_parsefns[32] = {
+    RXML_PARSEFN(0), RXML_PARSEFN(1), RXML_PARSEFN(2), RXML_PARSEFN(3),
+    RXML_PARSEFN(4), RXML_PARSEFN(5), RXML_PARSEFN(6), RXML_PARSEFN(7),
+    RXML_PARSEFN(8), RXML_PARSEFN(9), RXML_PARSEFN(10), RXML_PARSEFN(11),
+    RXML_PARSEFN(12), RXML_PARSEFN(13), RXML_PARSEFN(14), RXML_PARSEFN(15),
+    RXML_PARSEFN(16), RXML_PARSEFN(17), RXML_PARSEFN(18), RXML_PARSEFN(19),
+    RXML_PARSEFN(20), RXML_PARSEFN(21), RXML_PARSEFN(22), RXML_PARSEFN(23),
+    RXML_PARSEFN(24), RXML_PARSEFN(25), RXML_PARSEFN(26), RXML_PARSEFN(27),
+    RXML_PARSEFN(28), RXML_PARSEFN(29), RXML_PARSEFN(30), RXML_PARSEFN(31)
+};
+
+// The root element among the children of a document, skipping the
+// declaration, and the comments and processing instructions that
+// @parseflags can keep before it, or null if there is none
+template<class Node>
+static Node rxml_rootelement(Node node)
+{
+    while(node && node->type() != node_element)
+    {
+        node = node->next_sibling();
+    }
+    return node;
+}
+
+// An edit found by a diff, held until the whole script is known: op
+// and path, the symbols following the path, and for inserts the node
+// to send
+struct rxml_diffedit
+{
+    t_symbol *op;
+    std::string path;
+    t_symbol *arg1, *arg2;
+    const xml_node<> *node;
+};
+
+// Removes are kept apart from the other edits, as they are output
+// first, see rxml_diff_output()
+struct rxml_diffctx
+{
+    rxml *x;
+    std::unordered_map<const xml_node<> *, uint64_t> hashes;
+    std::vector<rxml_diffedit> removes, edits;
+    long nedits;
+};
+
+// A step of a diff, kept on a stack rather than recursed into: op is
+// RXML_DIFF_COMPARE to compare a with b, RXML_DIFF_REMOVE to report a
+// as removed, or RXML_DIFF_INSERT to report b as inserted. apath and
+// bpath are the paths of a and b.
+struct rxml_diffstep
+{
+    int op;
+    const xml_node<> *a, *b;
+    std::string apath, bpath;
+};
+
+#ifdef RAPIDXML_NO_EXCEPTIONS
+void rapidxml::parse_error_handler(const char *what, void *where)
+{
+    std::cout << "Parse error: " << what << "\n";
+    // this function must not return
+    std::abort();
+}
+#endif
+
+extern "C" {
+static void clearbuf(rxml *x);
+static void rxml_orient(rxml *x, xml_document<> *doc);
+
+// Appends received text to the ingestion queue, without waiting for
+// the text to be processed: writelock is only ever held by senders,
+// never by the parser
+static void rxml_anything(rxml *x,
+                          const t_symbol * const s,
+                          const long ac, const t_atom *av)
+{
+    assert(x);
+    assert(s);
+    const char * const str = s->s_name;
+    assert(str);
+    critical_enter(x->writelock);
+    const int err = rxml_ingest_write(x->ingest, str, strlen(str));
+    critical_exit(x->writelock);
+    if(err)
+    {
+        object_error((t_object *)x, "Out of memory!\n");
+    }
+}
+
+static void rxml_drain_append(void *arg, const char *s, size_t n)
+{
+    rxml *x = (rxml *)arg;
+    if(!x->buf)
+    {
+        return;
+    }
+    if(x->bufpos + n >= x->buflen)
+    {
+        const size_t buflen = std::max(x->buflen * 2, x->bufpos + n + 1);
+        char *buf = (char *)realloc(x->buf, buflen);
+        if(!buf)
+        {
+            object_error((t_object *)x, "Out of memory!\n");
+            free(x->buf);
+            x->buf = NULL;
+            x->buflen = 0;
+            x->bufpos = 0;
+            return;
+        }
+        x->buf = buf;
+        x->buflen = buflen;
+    }
+    memcpy(x->buf + x->bufpos, s, n);
+    x->bufpos += n;
+    x->buf[x->bufpos] = 0;
+}
+
+static void rxml_drain_discard(void *, const char *, size_t) {}
+
+// Moves the text received so far from the ingestion queue to x->buf.
+// Called with x->lock held.
+static void rxml_drain(rxml *x)
+{
+    rxml_ingest_read(x->ingest, rxml_drain_append, x);
+}
+
+// Returns a cleared registered dictionary owned by the instance,
+// creating it on first use, or NULL on failure
+static t_dictionary *rxml_ownedDict(rxml *x, t_dictionary **d,
+                                    t_symbol **name)
+{
+    if(!*d)
+    {
+        *d = dictobj_register(dictionary_new(), name);
+        if(!*d)
+        {
+            object_error((t_object *)x, "Couldn't register dict");
+            return NULL;
+        }
+    }
+    dictionary_clear(*d);
+    return *d;
+}
+
+// Outputs "<sel> <dictname>", where the dict, owned by the instance,
+// holds s as a string under the key sel
+static void rxml_outputString(rxml *x, t_dictionary **d, t_symbol **name,
+                              t_symbol *sel, const std::string &s)
+{
+    if(!rxml_ownedDict(x, d, name))
+    {
+        return;
+    }
+    dictionary_appendstring(*d, sel, s.c_str());
+    t_atom out;
+    atom_setsym(&out, *name);
+    outlet_anything(x->outlets[RXML_OUTLET_MAIN], sel, 1, &out);
+}
+
+// Outputs XML text s as a string or line by line, following @output
+static void rxml_outputText(rxml * const x, std::string &s)
+{
+    if(x->output == ps_string)
+    {
+        rxml_outputString(x, &x->xmldict, &x->xmldictname, ps_xml, s);
+        return;
+    }
+    // split into lines in place
+    char *p = &s[0];
+    char * const end = p + s.size();
+    while(p < end)
+    {
+        char *nl = (char *)memchr(p, '\n', end - p);
+        if(!nl)
+        {
+            nl = end;
+        }
+        if(nl != p)
+        {
+            *nl = 0;
+            t_symbol *s = gensym(p);
+            outlet_anything(x->outlets[RXML_OUTLET_MAIN], s, 0, NULL);
+        }
+        p = nl + 1;
+    }
+}
+
+static void rxml_outputXML(rxml * const x,
+                           const xml_document<> * const doc)
+{
+    std::string s;
+    print_bulk(s, *doc, 0);
+    rxml_outputText(x, s);
+}
+
+// Formats an integer, returning the number of characters written.
+// buf must hold at least RXML_NUMBUF_SIZE characters.
+static size_t rxml_formatlong(t_atom_long v, char *buf)
+{
+    char tmp[RXML_NUMBUF_SIZE];
+    size_t n = 0;
+    unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v
+                                 : (unsigned long long)v;
+    do
+    {
+        tmp[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while(u);
+    size_t len = 0;
+    if(v < 0)
+    {
+        buf[len++] = '-';
+    }
+    while(n)
+    {
+        buf[len++] = tmp[--n];
+    }
+    buf[len] = 0;
+    return len;
+}
+
+// Formats a float in the fewest characters that read back as the same
+// value, returning the number of characters written. Any decimal of up
+// to 15 digits survives a round trip through a normal double, so %.15g
+// already gives the shortest form of those values; the others take 16
+// digits or, failing that, 17. Subnormals hold fewer digits, so they
+// are tried from 1 digit up.
+static size_t rxml_formatfloat(double v, char *buf)
+{
+    const bool subnormal = v != 0. && std::fabs(v) < DBL_MIN;
+    int len = 0;
+    for(int digits = subnormal ? 1 : 15; digits <= 17; ++digits)
+    {
+        len = snprintf(buf, RXML_NUMBUF_SIZE, "%.*g", digits, v);
+        if(strtod(buf, NULL) == v)
+        {
+            break;
+        }
+    }
+    return (size_t)len;
+}
+
+// Returns the text of a symbol or number atom for use in doc, or
+// NULL if the atom is neither.
+static const char *rxml_atomtext(xml_document<> *doc, const t_atom *a)
+{
+    char buf[RXML_NUMBUF_SIZE];
+    size_t len = 0;
+    switch(atom_gettype(a))
+    {
+    case A_SYM:
+        return atom_getsym(a)->s_name;
+    case A_LONG:
+        len = rxml_formatlong(atom_getlong(a), buf);
+        break;
+    case A_FLOAT:
+        len = rxml_formatfloat(atom_getfloat(a), buf);
+        break;
+    default:
+        return NULL;
+    }
+    return doc->allocate_string(buf, len + 1);
+}
+
+// Returns the text of a list of symbols and numbers separated by spaces
+// for use in doc, formatted straight into its memory pool, and sets
+// *len to its length. A single symbol is used as is. Returns NULL if
+// the list is empty or has other atoms.
+static const char *rxml_atomstext(xml_document<> *doc, long n,
+                                  const t_atom *a, size_t *len)
+{
+    if(n == 1 && atom_gettype(a) == A_SYM)
+    {
+        const char * const s = atom_getsym(a)->s_name;
+        *len = strlen(s);
+        return s;
+    }
+    char buf[RXML_NUMBUF_SIZE];
+    if(n == 1 && (atom_gettype(a) == A_LONG || atom_gettype(a) == A_FLOAT))
+    {
+        *len = atom_gettype(a) == A_LONG
+            ? rxml_formatlong(atom_getlong(a), buf)
+            : rxml_formatfloat(atom_getfloat(a), buf);
+        return doc->allocate_string(buf, *len + 1);
+    }
+    // numbers are at most RXML_NUMBUF_SIZE - 1 characters, so the
+    // space is reserved once and the text formatted into it
+    size_t size = 0;
+    for(long i = 0; i < n; ++i)
+    {
+        switch(atom_gettype(a + i))
+        {
+        case A_SYM:
+            size += strlen(atom_getsym(a + i)->s_name) + 1;
+            break;
+        case A_LONG:
+        case A_FLOAT:
+            size += RXML_NUMBUF_SIZE;
+            break;
+        default:
+            return NULL;
+        }
+    }
+    if(!size)
+    {
+        return NULL;
+    }
+    char * const text = doc->allocate_string(0, size);
+    char *p = text;
+    for(long i = 0; i < n; ++i)
+    {
+        if(i)
+        {
+            *p++ = ' ';
+        }
+        switch(atom_gettype(a + i))
+        {
+        case A_SYM:
+        {
+            const char * const s = atom_getsym(a + i)->s_name;
+            const size_t l = strlen(s);
+            memcpy(p, s, l);
+            p += l;
+        }
+        break;
+        case A_LONG:
+            p += rxml_formatlong(atom_getlong(a + i), p);
+            break;
+        default:
+            p += rxml_formatfloat(atom_getfloat(a + i), p);
+            break;
+        }
+    }
+    *p = 0;
+    *len = p - text;
+    return text;
+}
+
+// Parses text as a number if formatting the number gives back exactly
+// the same text, so that a typed round trip preserves the document.
+// Returns 0 and sets a on success.
+static int rxml_parsenumber(const char *text, size_t len, t_atom *a)
+{
+    if(!len || len >= RXML_NUMBUF_SIZE)
+    {
+        return 1;
+    }
+    const char *p = text + (text[0] == '-');
+    const char * const end = text + len;
+    if(p == end || *p < '0' || *p > '9')
+    {
+        return 1;
+    }
+    bool integer = true;
+    for(const char *q = p; q < end; ++q)
+    {
+        if(*q < '0' || *q > '9')
+        {
+            if(*q != '.' && *q != 'e' && *q != 'E' && *q != '-' && *q != '+')
+            {
+                return 1;
+            }
+            integer = false;
+        }
+    }
+    char buf[RXML_NUMBUF_SIZE];
+    if(integer)
+    {
+        // 18 digits always fit in a 64-bit t_atom_long
+        if(end - p > 18 || (p[0] == '0' && end - p > 1)
+           || (p != text && end - p == 1 && p[0] == '0'))
+        {
+            return 1;
+        }
+        t_atom_long v = 0;
+        for(const char *q = p; q < end; ++q)
+        {
+            v = v * 10 + (*q - '0');
+        }
+        atom_setlong(a, p != text ? -v : v);
+        return 0;
+    }
+    memcpy(buf, text, len);
+    buf[len] = 0;
+    char *e = NULL;
+    const double v = strtod(buf, &e);
+    if(e != buf + len)
+    {
+        return 1;
+    }
+    char out[RXML_NUMBUF_SIZE];
+    if(rxml_formatfloat(v, out) != len || memcmp(out, text, len))
+    {
+        return 1;
+    }
+    atom_setfloat(a, v);
+    return 0;
+}
+
+// An element being built by rxml_toXML(), with the keys of its dict and
+// the next one to convert: an index into ordering if the dict has
+// .ordering, otherwise into keys
+struct rxml_xmlframe
+{
+    const t_dictionary *d;
+    xml_node<> *node;
+    t_symbol **keys;
+    long nkeys;
+    t_atom *ordering;
+    long nordering;
+    long i;
+    // number of elements of each name converted so far, with .ordering
+    t_hashtab *ht;
+};
+
+static void rxml_toXML_close(rxml_xmlframe *f)
+{
+    if(f->keys)
+    {
+        sysmem_freeptr(f->keys);
+    }
+    if(f->ht)
+    {
+        object_free((t_object *)f->ht);
+    }
+}
+
+// Creates element elem from d with its attributes, and pushes it onto
+// stack if it has children to convert. Returns NULL on error.
+static xml_node<> *rxml_toXML_open(const rxml *x,
+                                   xml_document<> *doc,
+                                   std::vector<rxml_xmlframe> &stack,
+                                   const char * const elem,
+                                   const t_dictionary * const d)
+{
+    assert(x);
+    assert(doc);
+    assert(elem);
+    assert(d);
+    rxml_xmlframe f = {d, NULL, NULL, 0, NULL, 0, 0, NULL};
+    if(dictionary_hasentry(d, ps_ordering))
+    {
+        dictionary_getatoms(d, ps_ordering, &f.nordering, &f.ordering);
+    }
+    dictionary_getkeys(d, &f.nkeys, &f.keys);
+    f.node = doc->allocate_node(node_element, elem);
+    if(!f.nkeys || !f.keys)
+    {
+        rxml_toXML_close(&f);
+        return f.node;
+    }
+    // attributes
+    for(long i = 0; i < f.nkeys; ++i)
+    {
+        if(f.keys[i]->s_name && f.keys[i]->s_name[0] == '@')
+        {
+            t_atom *vals = NULL;
+            long nvals = 0;
+            t_max_err e = dictionary_getatoms(d, f.keys[i], &nvals, &vals);
+            if(e)
+            {
+                object_error((t_object *)x,
+                             "dictionary_getatom() produced "
+                             "an error: %d",
+                             e);
+                rxml_toXML_close(&f);
+                return NULL;
+            }
+            size_t len = 0;
+            const char * const text = rxml_atomstext(doc, nvals, vals, &len);
+            if(!text)
+            {
+                object_error((t_object *)x,
+                             "couldn't convert atoms to string");
+                rxml_toXML_close(&f);
+                return NULL;
+            }
+            const char * const name = f.keys[i]->s_name + 1;
+            f.node->append_attribute(doc->allocate_attribute(name, text,
+                                                             strlen(name),
+                                                             len));
+        }
+    }
+    if(f.nordering)
+    {
+        f.ht = hashtab_new(0);
+    }
+    stack.push_back(f);
+    return f.node;
+}
+
+// Converts the next child of the element on top of stack, pushing it
+// if it is an element. Returns 0 to go on, 1 if the element is done, or
+// -1 on an error that stops the conversion.
+static int rxml_toXML_entry(const rxml *x,
+                            xml_document<> *doc,
+                            std::vector<rxml_xmlframe> &stack)
+{
+    rxml_xmlframe &f = stack.back();
+    // f is not used after rxml_toXML_open(), as pushing may move it
+    xml_node<> * const node = f.node;
+    if(f.nordering)
+    {
+        if(f.i >= f.nordering)
+        {
+            return 1;
+        }
+        t_symbol * const name = atom_getsym(f.ordering + f.i++);
+        if(!dictionary_hasentry(f.d, name))
+        {
+            object_error((t_object *)x,
+                         "found a symbol in .ordering that "
+                         "isn't in the dictionary");
+            return 1;
+        }
+        t_atom val;
+        t_max_err e = dictionary_getatom(f.d, name, &val);
+        if(e)
+        {
+            object_error((t_object *)x,
+                         "dictionary_getatom() produced "
+                         "an error: %d",
+                         e);
+            return -1;
+        }
+        if(atom_gettype(&val) == A_OBJ)
+        {
+            t_atom_long count = 0;
+            hashtab_lookuplong(f.ht, name, &count);
+            char buf[16];
+            snprintf(buf, 16, "%ld", (long)count);
+            hashtab_storelong(f.ht, name, count + 1);
+            t_atom idxa;
+            dictionary_getatom((t_dictionary *)atom_getobj(&val),
+                               gensym(buf),
+                               &idxa);
+            if(atom_gettype(&idxa) != A_OBJ)
+            {
+                object_error((t_object *)x,
+                             "found something other than a dict.");
+                return -1;
+            }
+            xml_node<> *nn =
+                rxml_toXML_open(x, doc, stack, name->s_name,
+                                (t_dictionary *)atom_getobj(&idxa));
+            if(!nn)
+            {
+                return -1;
+            }
+            node->append_node(nn);
+        }
+        else
+        {
+            const char * const text = rxml_atomtext(doc, &val);
+            if(!text)
+            {
+                object_error((t_object *)x,
+                             "found an entry that is "
+                             "not a string or number");
+                return 1;
+            }
+            node->append_node(doc->allocate_node(node_element,
+                                                 name->s_name,
+                                                 text));
+        }
+        return 0;
+    }
+
+    if(f.i >= f.nkeys)
+    {
+        return 1;
+    }
+    t_symbol * const key = f.keys[f.i++];
+    // symbols are unique, so comparing them compares names
+    if(!key->s_name || key->s_name[0] == '@' || key == ps_ordering)
+    {
+        return 0;
+    }
+    t_atom val;
+    t_max_err e = dictionary_getatom(f.d, key, &val);
+    if(e)
+    {
+        object_error((t_object *)x,
+                     "dictionary_getatom() produced "
+                     "an error: %d",
+                     e);
+        return -1;
+    }
+    if(atom_gettype(&val) == A_OBJ)
+    {
+        xml_node<> *nn =
+            rxml_toXML_open(x, doc, stack, node->name(),
+                            (t_dictionary *)atom_getobj(&val));
+        if(!nn)
+        {
+            return -1;
+        }
+        node->append_node(nn);
+    }
+    else
+    {
+        // data nodes, one for each atom, see rxml_appendpiece()
+        t_atom *vals = NULL;
+        long nvals = 0;
+        dictionary_getatoms(f.d, key, &nvals, &vals);
+        for(long i = 0; i < nvals; ++i)
+        {
+            const char * const text = rxml_atomtext(doc, vals + i);
+            if(!text)
+            {
+                object_error((t_object *)x,
+                             "found an entry that is "
+                             "not a string or number");
+                return 1;
+            }
+            node->append_node(doc->allocate_node(key == ps_comment
+                                                 ? node_comment
+                                                 : node_data,
+                                                 key->s_name,
+                                                 text));
+        }
+    }
+    return 0;
+}
+
+// Builds element elem of doc from d. The elements being built are kept
+// on a stack on the heap rather than the call stack, so nesting depth is
+// limited only by memory. Returns NULL on error.
+static xml_node<> *rxml_toXML(const rxml *x,
+                              xml_document<> *doc,
+                              const char * const elem,
+                              const t_dictionary * const d)
+{
+    std::vector<rxml_xmlframe> stack;
+    xml_node<> *root = rxml_toXML_open(x, doc, stack, elem, d);
+    while(root && !stack.empty())
+    {
+        const int e = rxml_toXML_entry(x, doc, stack);
+        if(e > 0)
+        {
+            rxml_toXML_close(&stack.back());
+            stack.pop_back();
+        }
+        else if(e < 0)
+        {
+            root = NULL;
+        }
+    }
+    for(size_t i = 0; i < stack.size(); ++i)
+    {
+        rxml_toXML_close(&stack[i]);
+    }
+    return root;
+}
+
+// Receives the text written by rxml_stream(). With @output lines each
+// line is output as soon as it is complete, so only the line being
+// written is held; otherwise the text collects for output as a string.
+struct rxml_exportjob;
+
+struct rxml_xmlsink
+{
+    rxml *x;
+    bool lines;
+    std::string text;
+    // if set, the children of the root are left to these, see
+    // rxml_stream_parallel()
+    std::vector<rxml_exportjob> *jobs;
+};
+
+// A child of the root exported on its own by rxml_stream_parallel().
+// Its text goes at pos in the text of the root.
+struct rxml_exportjob
+{
+    const char *name;
+    const t_dictionary *d;
+    size_t pos;
+    std::string text;
+    int err;
+};
+
+static void rxml_sink_write(rxml_xmlsink *k, const char *s, size_t n)
+{
+    const size_t start = k->text.size();
+    k->text.append(s, n);
+    if(!k->lines || !memchr(s, '\n', n))
+    {
+        return;
+    }
+    // output complete lines, skipping empty ones as rxml_outputXML() does
+    size_t p = 0, nl;
+    while((nl = k->text.find('\n', std::max(p, start))) != std::string::npos)
+    {
+        if(nl != p)
+        {
+            k->text[nl] = 0;
+            outlet_anything(k->x->outlets[RXML_OUTLET_MAIN],
+                            gensym(&k->text[p]), 0, NULL);
+        }
+        p = nl + 1;
+    }
+    k->text.erase(0, p);
+}
+
+static void rxml_sink_indent(rxml_xmlsink *k, int n)
+{
+    static const char tabs[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+    for(; n > 0; n -= 16)
+    {
+        rxml_sink_write(k, tabs, n < 16 ? n : 16);
+    }
+}
+
+// Writes n characters of s, replacing the characters print() expands
+// with references, except noexpand
+static void rxml_sink_escaped(rxml_xmlsink *k, const char *s, size_t n,
+                              char noexpand)
+{
+    const char *run = s;
+    for(const char * const end = s + n; s < end; ++s)
+    {
+        const char *ref;
+        switch(*s)
+        {
+        case '<': ref = "&lt;"; break;
+        case '>': ref = "&gt;"; break;
+        case '\'': ref = "&apos;"; break;
+        case '"': ref = "&quot;"; break;
+        case '&': ref = "&amp;"; break;
+        default: continue;
+        }
+        if(*s == noexpand)
+        {
+            continue;
+        }
+        rxml_sink_write(k, run, s - run);
+        rxml_sink_write(k, ref, strlen(ref));
+        run = s + 1;
+    }
+    rxml_sink_write(k, run, s - run);
+}
+
+// Writes the text of a symbol or number, as rxml_atomtext() gives it.
+// Returns 1 if the atom is neither.
+static int rxml_sink_atom(rxml_xmlsink *k, const t_atom *a, char noexpand)
+{
+    char buf[RXML_NUMBUF_SIZE];
+    switch(atom_gettype(a))
+    {
+    case A_SYM:
+    {
+        const char * const s = atom_getsym(a)->s_name;
+        rxml_sink_escaped(k, s, strlen(s), noexpand);
+        return 0;
+    }
+    case A_LONG:
+        rxml_sink_write(k, buf, rxml_formatlong(atom_getlong(a), buf));
+        return 0;
+    case A_FLOAT:
+        rxml_sink_write(k, buf, rxml_formatfloat(atom_getfloat(a), buf));
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+// An element being written by rxml_stream(), with the keys of its dict
+// and the next one to write, as in rxml_xmlframe
+struct rxml_streamframe
+{
+    const t_dictionary *d;
+    const char *name;
+    int indent;
+    t_symbol **keys;
+    long nkeys;
+    t_atom *ordering;
+    long nordering;
+    long i;
+    t_hashtab *ht;
+};
+
+static void rxml_stream_close(rxml_streamframe *f)
+{
+    if(f->keys)
+    {
+        sysmem_freeptr(f->keys);
+    }
+    if(f->ht)
+    {
+        object_free((t_object *)f->ht);
+    }
+}
+
+// Writes the attributes of d as rxml_toXML_open() converts them.
+// Returns 0 on success.
+static int rxml_stream_attributes(rxml_xmlsink *k, const rxml_streamframe *f)
+{
+    for(long i = 0; i < f->nkeys; ++i)
+    {
+        if(!f->keys[i]->s_name || f->keys[i]->s_name[0] != '@')
+        {
+            continue;
+        }
+        t_atom *vals = NULL;
+        long nvals = 0;
+        t_max_err e = dictionary_getatoms(f->d, f->keys[i], &nvals, &vals);
+        if(e)
+        {
+            object_error((t_object *)k->x,
+                         "dictionary_getatom() produced "
+                         "an error: %d",
+                         e);
+            return 1;
+        }
+        // quote with ' if the value has a ", as print() does
+        bool dquote = false;
+        for(long j = 0; j < nvals; ++j)
+        {
+            if(atom_gettype(vals + j) == A_SYM
+               && strchr(atom_getsym(vals + j)->s_name, '"'))
+            {
+                dquote = true;
+            }
+            else if(atom_gettype(vals + j) != A_SYM
+                    && atom_gettype(vals + j) != A_LONG
+                    && atom_gettype(vals + j) != A_FLOAT)
+            {
+                nvals = 0;
+            }
+        }
+        if(!nvals)
+        {
+            object_error((t_object *)k->x,
+                         "couldn't convert atoms to string");
+            return 1;
+        }
+        const char * const quote = dquote ? "'" : "\"";
+        rxml_sink_write(k, " ", 1);
+        rxml_sink_write(k, f->keys[i]->s_name + 1,
+                        strlen(f->keys[i]->s_name + 1));
+        rxml_sink_write(k, "=", 1);
+        rxml_sink_write(k, quote, 1);
+        for(long j = 0; j < nvals; ++j)
+        {
+            if(j)
+            {
+                rxml_sink_write(k, " ", 1);
+            }
+            rxml_sink_atom(k, vals + j, dquote ? '"' : '\'');
+        }
+        rxml_sink_write(k, quote, 1);
+    }
+    return 0;
+}
+
+static void rxml_stream_end(rxml_xmlsink *k, const char *name)
+{
+    rxml_sink_write(k, "</", 2);
+    rxml_sink_write(k, name, strlen(name));
+    rxml_sink_write(k, ">\n", 2);
+}
+
+// Writes the start of element name from d at the given indent, and
+// pushes it onto stack if its children go on lines of their own. An
+// element with no children, or only one that is data, is written
+// whole. Returns 0 on success.
+static int rxml_stream_open(rxml_xmlsink *k,
+                            std::vector<rxml_streamframe> &stack,
+                            const char * const name,
+                            const t_dictionary * const d,
+                            int indent)
+{
+    rxml_streamframe f = {d, name, indent, NULL, 0, NULL, 0, 0, NULL};
+    if(dictionary_hasentry(d, ps_ordering))
+    {
+        dictionary_getatoms(d, ps_ordering, &f.nordering, &f.ordering);
+    }
+    dictionary_getkeys(d, &f.nkeys, &f.keys);
+    rxml_sink_indent(k, indent);
+    rxml_sink_write(k, "<", 1);
+    rxml_sink_write(k, name, strlen(name));
+    if(!f.nkeys || !f.keys)
+    {
+        rxml_sink_write(k, ">", 1);
+        rxml_stream_end(k, name);
+        rxml_stream_close(&f);
+        return 0;
+    }
+    if(rxml_stream_attributes(k, &f))
+    {
+        rxml_stream_close(&f);
+        return 1;
+    }
+    rxml_sink_write(k, ">", 1);
+
+    // without .ordering, the children are the keys other than
+    // attributes, see rxml_toXML_entry()
+    t_symbol *only = NULL;
+    long nchildren = f.nordering;
+    for(long i = 0; !f.nordering && i < f.nkeys; ++i)
+    {
+        if(f.keys[i]->s_name && f.keys[i]->s_name[0] != '@'
+           && f.keys[i] != ps_ordering)
+        {
+            only = f.keys[i];
+            ++nchildren;
+        }
+    }
+    t_atom *vals = NULL;
+    long nvals = 0;
+    if(nchildren == 1 && only && only != ps_comment
+       && !dictionary_getatoms(d, only, &nvals, &vals) && nvals == 1
+       && atom_gettype(vals) != A_OBJ)
+    {
+        // a sole data child is written inline
+        const int err = rxml_sink_atom(k, vals, 0);
+        rxml_stream_end(k, name);
+        rxml_stream_close(&f);
+        if(err)
+        {
+            object_error((t_object *)k->x,
+                         "found an entry that is "
+                         "not a string or number");
+            return 1;
+        }
+        return 0;
+    }
+    if(!nchildren)
+    {
+        rxml_stream_end(k, name);
+        rxml_stream_close(&f);
+        return 0;
+    }
+    rxml_sink_write(k, "\n", 1);
+    if(f.nordering)
+    {
+        f.ht = hashtab_new(0);
+    }
+    stack.push_back(f);
+    return 0;
+}
+
+// Writes child element name from d, or leaves it to a job if it is a
+// child of the root and the sink has jobs. Returns 0 on success.
+static int rxml_stream_child(rxml_xmlsink *k,
+                             std::vector<rxml_streamframe> &stack,
+                             const char * const name,
+                             const t_dictionary * const d,
+                             int indent)
+{
+    if(k->jobs && indent == 1)
+    {
+        rxml_exportjob j;
+        j.name = name;
+        j.d = d;
+        j.pos = k->text.size();
+        j.err = 0;
+        k->jobs->push_back(j);
+        return 0;
+    }
+    return rxml_stream_open(k, stack, name, d, indent);
+}
+
+// Writes the next child of the element on top of stack, following
+// rxml_toXML_entry(). Returns 0 to go on, 1 if the element is done, or
+// -1 on an error that stops the export.
+static int rxml_stream_entry(rxml_xmlsink *k,
+                             std::vector<rxml_streamframe> &stack)
+{
+    rxml_streamframe &f = stack.back();
+    // f is not used after rxml_stream_open(), as pushing may move it
+    const int indent = f.indent + 1;
+    if(f.nordering)
+    {
+        if(f.i >= f.nordering)
+        {
+            return 1;
+        }
+        t_symbol * const name = atom_getsym(f.ordering + f.i++);
+        if(!dictionary_hasentry(f.d, name))
+        {
+            object_error((t_object *)k->x,
+                         "found a symbol in .ordering that "
+                         "isn't in the dictionary");
+            return 1;
+        }
+        t_atom val;
+        t_max_err e = dictionary_getatom(f.d, name, &val);
+        if(e)
+        {
+            object_error((t_object *)k->x,
+                         "dictionary_getatom() produced "
+                         "an error: %d",
+                         e);
+            return -1;
+        }
+        if(atom_gettype(&val) == A_OBJ)
+        {
+            t_atom_long count = 0;
+            hashtab_lookuplong(f.ht, name, &count);
+            char buf[16];
+            snprintf(buf, 16, "%ld", (long)count);
+            hashtab_storelong(f.ht, name, count + 1);
+            t_atom idxa;
+            dictionary_getatom((t_dictionary *)atom_getobj(&val),
+                               gensym(buf),
+                               &idxa);
+            if(atom_gettype(&idxa) != A_OBJ)
+            {
+                object_error((t_object *)k->x,
+                             "found something other than a dict.");
+                return -1;
+            }
+            return rxml_stream_child(k, stack, name->s_name,
+                                     (t_dictionary *)atom_getobj(&idxa),
+                                     indent) ? -1 : 0;
+        }
+        rxml_sink_indent(k, indent);
+        rxml_sink_write(k, "<", 1);
+        rxml_sink_write(k, name->s_name, strlen(name->s_name));
+        rxml_sink_write(k, ">", 1);
+        const int err = rxml_sink_atom(k, &val, 0);
+        rxml_stream_end(k, name->s_name);
+        if(err)
+        {
+            object_error((t_object *)k->x,
+                         "found an entry that is "
+                         "not a string or number");
+            return 1;
+        }
+        return 0;
+    }
+
+    if(f.i >= f.nkeys)
+    {
+        return 1;
+    }
+    t_symbol * const key = f.keys[f.i++];
+    // symbols are unique, so comparing them compares names
+    if(!key->s_name || key->s_name[0] == '@' || key == ps_ordering)
+    {
+        return 0;
+    }
+    t_atom val;
+    t_max_err e = dictionary_getatom(f.d, key, &val);
+    if(e)
+    {
+        object_error((t_object *)k->x,
+                     "dictionary_getatom() produced "
+                     "an error: %d",
+                     e);
+        return -1;
+    }
+    if(atom_gettype(&val) == A_OBJ)
+    {
+        return rxml_stream_child(k, stack, f.name,
+                                 (t_dictionary *)atom_getobj(&val),
+                                 indent) ? -1 : 0;
+    }
+    // a line for each atom, see rxml_appendpiece()
+    t_atom *vals = NULL;
+    long nvals = 0;
+    dictionary_getatoms(f.d, key, &nvals, &vals);
+    int err = 0;
+    for(long i = 0; i < nvals; ++i)
+    {
+        const t_atom * const a = vals + i;
+        rxml_sink_indent(k, indent);
+        if(key == ps_comment)
+        {
+            // comments are written without references, as print() does
+            rxml_sink_write(k, "<!--", 4);
+            char buf[RXML_NUMBUF_SIZE];
+            if(atom_gettype(a) == A_SYM)
+            {
+                rxml_sink_write(k, atom_getsym(a)->s_name,
+                                strlen(atom_getsym(a)->s_name));
+            }
+            else if(atom_gettype(a) == A_LONG)
+            {
+                rxml_sink_write(k, buf,
+                                rxml_formatlong(atom_getlong(a), buf));
+            }
+            else if(atom_gettype(a) == A_FLOAT)
+            {
+                rxml_sink_write(k, buf,
+                                rxml_formatfloat(atom_getfloat(a), buf));
+            }
+            else
+            {
+                err = 1;
+            }
+            rxml_sink_write(k, "-->", 3);
+        }
+        else
+        {
+            err |= rxml_sink_atom(k, a, 0);
+        }
+        rxml_sink_write(k, "\n", 1);
+    }
+    if(err)
+    {
+        object_error((t_object *)k->x,
+                     "found an entry that is "
+                     "not a string or number");
+        return 1;
+    }
+    return 0;
+}
+
+// Writes element name from d and everything under it at the given
+// indent. The dict is walked as rxml_toXML() walks it, and the text is
+// what print() gives for the document rxml_toXML() would build. Memory
+// beyond the output is one frame per open element. Returns 0 on success.
+static int rxml_stream_walk(rxml_xmlsink *k, const char * const name,
+                            const t_dictionary * const d, int indent)
+{
+    std::vector<rxml_streamframe> stack;
+    int err = rxml_stream_open(k, stack, name, d, indent);
+    while(!err && !stack.empty())
+    {
+        const int e = rxml_stream_entry(k, stack);
+        if(e > 0)
+        {
+            rxml_sink_indent(k, stack.back().indent);
+            rxml_stream_end(k, stack.back().name);
+            rxml_stream_close(&stack.back());
+            stack.pop_back();
+        }
+        else if(e < 0)
+        {
+            err = 1;
+        }
+    }
+    for(size_t i = 0; i < stack.size(); ++i)
+    {
+        rxml_stream_close(&stack[i]);
+    }
+    return err;
+}
+
+// Exports root element name from d without building a document, see
+// rxml_stream_walk(). Returns 0 on success.
+static int rxml_stream(rxml *x, const char * const name,
+                       const t_dictionary * const d)
+{
+    rxml_xmlsink k;
+    k.x = x;
+    k.lines = x->output != ps_string;
+    k.jobs = NULL;
+    if(rxml_stream_walk(&k, name, d, 0))
+    {
+        return 1;
+    }
+    // the document ends with a line break of its own
+    rxml_sink_write(&k, "\n", 1);
+    if(!k.lines)
+    {
+        rxml_outputString(x, &x->xmldict, &x->xmldictname, ps_xml, k.text);
+    }
+    return 0;
+}
+
+// The jobs of an export, taken in turn by the tasks running it
+struct rxml_exportrun
+{
+    rxml *x;
+    std::vector<rxml_exportjob> *jobs;
+    std::atomic<size_t> next;
+};
+
+// Runs jobs until there are none left
+static void rxml_exportrun_task(void *arg)
+{
+    rxml_exportrun * const r = (rxml_exportrun *)arg;
+    size_t i;
+    while((i = r->next++) < r->jobs->size())
+    {
+        rxml_exportjob &j = (*r->jobs)[i];
+        rxml_xmlsink k;
+        k.x = r->x;
+        k.lines = false;
+        k.jobs = NULL;
+        j.err = rxml_stream_walk(&k, j.name, j.d, 1);
+        j.text.swap(k.text);
+    }
+}
+
+// Exports root element name from d like rxml_stream(), with each child
+// of the root (the parts of a partwise score, the measures of a timewise
+// one) written into a buffer of its own by up to nthreads tasks on the
+// worker pool, this thread running one of them. The buffers are joined
+// in .ordering order, so the text is the same. Returns 0 on success.
+static int rxml_stream_parallel(rxml *x, const char * const name,
+                                const t_dictionary * const d,
+                                long nthreads)
+{
+    std::vector<rxml_exportjob> jobs;
+    rxml_xmlsink k;
+    k.x = x;
+    k.lines = false;
+    k.jobs = &jobs;
+    if(rxml_stream_walk(&k, name, d, 0))
+    {
+        return 1;
+    }
+    rxml_exportrun r;
+    r.x = x;
+    r.jobs = &jobs;
+    r.next = 0;
+    rxml_taskgroup group;
+    for(long i = 1; i < nthreads && (size_t)i < jobs.size(); ++i)
+    {
+        rxml_pool_submit(RXML_PRIORITY_INTERACTIVE, rxml_exportrun_task,
+                         &r, &group);
+    }
+    rxml_exportrun_task(&r);
+    rxml_taskgroup_wait(&group);
+    size_t size = k.text.size() + 1;
+    for(size_t i = 0; i < jobs.size(); ++i)
+    {
+        if(jobs[i].err)
+        {
+            return 1;
+        }
+        size += jobs[i].text.size();
+    }
+    std::string s;
+    s.reserve(size);
+    size_t pos = 0;
+    for(size_t i = 0; i < jobs.size(); ++i)
+    {
+        s.append(k.text, pos, jobs[i].pos - pos);
+        s.append(jobs[i].text);
+        pos = jobs[i].pos;
+        std::string().swap(jobs[i].text);
+    }
+    s.append(k.text, pos, std::string::npos);
+    s.push_back('\n');
+    rxml_outputText(x, s);
+    return 0;
+}
+
+// Tests if @orientation would convert a score with the given root, which
+// needs the document rxml_stream() does without
+static bool rxml_reorients(const rxml *x, const char *root)
+{
+    return (x->orientation == ps_timewise && !strcmp(root, "score-partwise"))
+        || (x->orientation == ps_partwise && !strcmp(root, "score-timewise"));
+}
+
+static void rxml_dictionary(rxml *x, const t_symbol * const s)
+{
+    assert(x);
+    assert(s);
+    xml_document<> doc;
+    xml_node<> *node = NULL;
+    t_dictionary *d = dictobj_findregistered_retain((t_symbol *)s);
+    if(!d)
+    {
+        object_error((t_object *)x, "Couldn't find dictionary %s",
+                     s->s_name);
+        return;
+    }
+    {
+        t_max_err e = MAX_ERR_NONE;
+        t_symbol **keys = NULL;
+        long nkeys = 0;
+        t_atom val;
+        e = dictionary_getkeys(d, &nkeys, &keys);
+        if(e != MAX_ERR_NONE)
+        {
+            object_error((t_object *)x,
+                         "dictionary_getkeys() returned an error: %d",
+                         e);
+            goto cleanup;
+        }
+        if(!nkeys || !keys)
+        {
+            object_error((t_object *)x, "dictionary is empty");
+            goto cleanup;
+        }
+        if(nkeys > 1)
+        {
+            object_error((t_object *)x,
+                         "malformed dictionary: "
+                         "more than one root node");
+            goto cleanup;
+        }
+        e = dictionary_getatom(d, keys[0], &val);
+        if(e != MAX_ERR_NONE)
+        {
+            object_error((t_object *)x,
+                         "dictionary_getatom() returned an error: %d",
+                         e);
+            goto cleanup;
+        }
+        if(atom_gettype(&val) != A_OBJ)
+        {
+            object_error((t_object *)x,
+                         "data for the root node is not a dict");
+            goto cleanup;
+        }
+        if(x->threads != 1 && !rxml_reorients(x, keys[0]->s_name))
+        {
+            rxml_stream_parallel(x, keys[0]->s_name,
+                                 (t_dictionary *)atom_getobj(&val),
+                                 x->threads ? x->threads
+                                 : rxml_pool_size());
+            sysmem_freeptr(keys);
+            goto cleanup;
+        }
+        if(x->stream && !rxml_reorients(x, keys[0]->s_name))
+        {
+            rxml_stream(x, keys[0]->s_name,
+                        (t_dictionary *)atom_getobj(&val));
+            sysmem_freeptr(keys);
+            goto cleanup;
+        }
+        node = rxml_toXML(x, &doc, 
+                          keys[0]->s_name,
+                          (t_dictionary *)atom_getobj(&val));
+        if(node)
+        {
+        	doc.append_node(node);
+        }
+        rxml_orient(x, &doc);
+        rxml_outputXML(x, &doc);
+        if(keys)
+        {
+            sysmem_freeptr(keys);
+        }
+    }
+    
+cleanup:
+    dictobj_release(d);
+    doc.clear();
+}
+
+// Tests if the n characters at s are the string str
+static bool rxml_equals(const char *s, size_t n, const char *str)
+{
+    return !strncmp(s, str, n) && !str[n];
+}
+
+// Tests for XML whitespace
+static bool rxml_isspace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool rxml_isnamed(const xml_node<> *node, const char *name)
+{
+    return rxml_equals(node->name(), node->name_size(), name);
+}
+
+// Text of the first child element with the given name, or NULL. It is
+// not terminated in documents from rxml_parseranges(), where the
+// markup after it ends the numbers and letters read from it.
+static const char *rxml_childtext(const xml_node<> *node,
+                                  const char *name)
+{
+    const xml_node<> *n = node->first_node(name);
+    return n ? n->value() : NULL;
+}
+
+static void rxml_cursor_init(rxml_cursor *c)
+{
+    c->part = c->measure = -1;
+    c->divisions = 1.;
+    c->pos = c->maxpos = c->lastonset = 0.;
+    c->note = -1;
+}
+
+static void rxml_cursor_part(rxml_cursor *c)
+{
+    ++(c->part);
+    c->measure = -1;
+    c->divisions = 1.;
+    c->pos = c->maxpos = c->lastonset = 0.;
+}
+
+static void rxml_cursor_measure(rxml_cursor *c)
+{
+    // a measure starts after the longest voice of the previous one
+    ++(c->measure);
+    c->pos = c->maxpos;
+    c->note = -1;
+}
+
+static double rxml_cursor_duration(const rxml_cursor *c,
+                                   const xml_node<> *node)
+{
+    const char * const d = rxml_childtext(node, "duration");
+    return d ? atof(d) / c->divisions : 0.;
+}
+
+// Advances the cursor past a child of <measure>. For a <note>, returns
+// its onset and sets *duration; returns -1 for other elements.
+static double rxml_cursor_advance(rxml_cursor *c,
+                                  const xml_node<> *node,
+                                  double *duration)
+{
+    double onset = -1.;
+    if(rxml_isnamed(node, "note"))
+    {
+        const double dur = rxml_cursor_duration(c, node);
+        ++(c->note);
+        if(node->first_node("chord"))
+        {
+            onset = c->lastonset;
+        }
+        else
+        {
+            onset = c->lastonset = c->pos;
+            c->pos += dur;
+        }
+        if(duration)
+        {
+            *duration = dur;
+        }
+    }
+    else if(rxml_isnamed(node, "backup"))
+    {
+        c->pos -= rxml_cursor_duration(c, node);
+        if(c->pos < 0.)
+        {
+            c->pos = 0.;
+        }
+    }
+    else if(rxml_isnamed(node, "forward"))
+    {
+        c->pos += rxml_cursor_duration(c, node);
+    }
+    else if(rxml_isnamed(node, "attributes"))
+    {
+        const char * const d = rxml_childtext(node, "divisions");
+        if(d && atof(d) > 0.)
+        {
+            c->divisions = atof(d);
+        }
+    }
+    if(c->pos > c->maxpos)
+    {
+        c->maxpos = c->pos;
+    }
+    return onset;
+}
+
+// Reads the pitch of a <note>, using the display position of an
+// <unpitched> one. Returns false for rests, with *step set to -1.
+static bool rxml_notepitch(const xml_node<> *note, long *step,
+                           double *alter, long *octave)
+{
+    static const char steps[] = "CDEFGAB";
+    *step = -1;
+    *octave = 0;
+    *alter = 0.;
+    const xml_node<> *p = note->first_node("pitch");
+    const char *s = p ? rxml_childtext(p, "step") : NULL;
+    const char *o = p ? rxml_childtext(p, "octave") : NULL;
+    if(!p && (p = note->first_node("unpitched")))
+    {
+        s = rxml_childtext(p, "display-step");
+        o = rxml_childtext(p, "display-octave");
+    }
+    if(s && s[0])
+    {
+        const char * const c = strchr(steps, s[0]);
+        *step = c ? (long)(c - steps) : -1;
+    }
+    if(o)
+    {
+        *octave = atol(o);
+    }
+    if(p && (s = rxml_childtext(p, "alter")))
+    {
+        *alter = atof(s);
+    }
+    return *step >= 0;
+}
+
+// MIDI note number of a <note>, with alter as a fraction, or 0 for a
+// rest
+static double rxml_midipitch(const xml_node<> *note)
+{
+    static const long semitones[] = { 0, 2, 4, 5, 7, 9, 11 };
+    long step, octave;
+    double alter;
+    if(!rxml_notepitch(note, &step, &alter, &octave))
+    {
+        return 0.;
+    }
+    return (octave + 1) * 12 + semitones[step] + alter;
+}
+
+// Tie flags of a <note>: 1 if it starts a tie, 2 if it ends one
+static long rxml_notetie(const xml_node<> *note)
+{
+    long tie = 0;
+    for(const xml_node<> *n = note->first_node("tie");
+        n;
+        n = n->next_sibling("tie"))
+    {
+        const xml_attribute<> *type = n->first_attribute("type");
+        if(type && rxml_equals(type->value(), type->value_size(), "start"))
+        {
+            tie |= 1;
+        }
+        else if(type
+                && rxml_equals(type->value(), type->value_size(), "stop"))
+        {
+            tie |= 2;
+        }
+    }
+    return tie;
+}
+
+static void rxml_notes_add(rxml_notetable *t,
+                           const xml_node<> *note,
+                           double onset, double duration)
+{
+    t_atom a;
+    long step, octave;
+    double alter;
+    rxml_notepitch(note, &step, &alter, &octave);
+    const long tie = rxml_notetie(note);
+    const char * const v = rxml_childtext(note, "voice");
+    atom_setlong(&a, t->cursor.part);
+    t->part.push_back(a);
+    atom_setlong(&a, t->cursor.measure);
+    t->measure.push_back(a);
+    atom_setlong(&a, v ? atol(v) : 1);
+    t->voice.push_back(a);
+    atom_setlong(&a, step);
+    t->step.push_back(a);
+    atom_setfloat(&a, alter);
+    t->alter.push_back(a);
+    atom_setlong(&a, octave);
+    t->octave.push_back(a);
+    atom_setfloat(&a, duration);
+    t->duration.push_back(a);
+    atom_setlong(&a, tie);
+    t->tie.push_back(a);
+    atom_setfloat(&a, onset);
+    t->onset.push_back(a);
+    const rxml_event e = {
+        onset, t->cursor.part, t->cursor.measure, t->cursor.note
+    };
+    t->events.push_back(e);
+}
+
+// Updates the note table for an element in a measure
+static void rxml_notes_event(rxml_notetable *t, const xml_node<> *node)
+{
+    double duration = 0.;
+    const double onset = rxml_cursor_advance(&(t->cursor), node, &duration);
+    if(onset >= 0.)
+    {
+        rxml_notes_add(t, node, onset, duration);
+    }
+}
+
+// Starts a measure of the current part in the note table
+static void rxml_notes_measure(rxml_notetable *t)
+{
+    rxml_cursor_measure(&(t->cursor));
+    const rxml_event e = {
+        t->cursor.pos, t->cursor.part, t->cursor.measure, -1
+    };
+    while((long)t->times.parts.size() <= t->cursor.part)
+    {
+        t->times.parts.push_back(t->times.measures.size());
+    }
+    t->times.measures.push_back(e);
+}
+
+// Updates the note table for an element of a partwise score. Called
+// for elements in document order, either while converting to a dict
+// or from rxml_notes_walk().
+static void rxml_notes_visit(rxml_notetable *t, const xml_node<> *node)
+{
+    const xml_node<> * const parent = node->parent();
+    if(!parent || !parent->parent())
+    {
+        return;
+    }
+    if(rxml_isnamed(parent, "measure"))
+    {
+        rxml_notes_event(t, node);
+    }
+    else if(rxml_isnamed(node, "measure") && rxml_isnamed(parent, "part"))
+    {
+        rxml_notes_measure(t);
+    }
+    else if(rxml_isnamed(node, "part")
+            && parent->parent()->type() == node_document)
+    {
+        rxml_cursor_part(&(t->cursor));
+    }
+}
+
+// Tests if two parts have the same id, or both have none
+static bool rxml_sameid(const xml_node<> *a, const xml_node<> *b)
+{
+    const xml_attribute<> * const ida = a->first_attribute("id");
+    const xml_attribute<> * const idb = b->first_attribute("id");
+    return (!ida && !idb)
+        || (ida && idb && ida->value_size() == idb->value_size()
+            && !memcmp(ida->value(), idb->value(), ida->value_size()));
+}
+
+// Fills the note table from a timewise score a part at a time, as from
+// the partwise score rxml_topartwise() would make of it
+static void rxml_notes_walktimewise(rxml_notetable *t,
+                                    const xml_node<> *root)
+{
+    // a part of each id, in the order in which the ids first appear
+    std::vector<const xml_node<> *> parts;
+    for(const xml_node<> *m = root->first_node("measure");
+        m;
+        m = m->next_sibling("measure"))
+    {
+        for(const xml_node<> *p = m->first_node("part");
+            p;
+            p = p->next_sibling("part"))
+        {
+            size_t i = 0;
+            while(i < parts.size() && !rxml_sameid(parts[i], p))
+            {
+                ++i;
+            }
+            if(i == parts.size())
+            {
+                parts.push_back(p);
+            }
+        }
+    }
+    for(size_t i = 0; i < parts.size(); ++i)
+    {
+        rxml_cursor_part(&(t->cursor));
+        for(const xml_node<> *m = root->first_node("measure");
+            m;
+            m = m->next_sibling("measure"))
+        {
+            for(const xml_node<> *p = m->first_node("part");
+                p;
+                p = p->next_sibling("part"))
+            {
+                if(!rxml_sameid(parts[i], p))
+                {
+                    continue;
+                }
+                rxml_notes_measure(t);
+                for(const xml_node<> *n = p->first_node();
+                    n;
+                    n = n->next_sibling())
+                {
+                    if(n->type() == node_element)
+                    {
+                        rxml_notes_event(t, n);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Fills the note table from a document without building a dict
+static void rxml_notes_walk(rxml_notetable *t, const xml_node<> *root)
+{
+    if(rxml_isnamed(root, "score-timewise"))
+    {
+        rxml_notes_walktimewise(t, root);
+        return;
+    }
+    for(const xml_node<> *part = root->first_node("part");
+        part;
+        part = part->next_sibling("part"))
+    {
+        rxml_notes_visit(t, part);
+        for(const xml_node<> *m = part->first_node("measure");
+            m;
+            m = m->next_sibling("measure"))
+        {
+            rxml_notes_visit(t, m);
+            for(const xml_node<> *n = m->first_node();
+                n;
+                n = n->next_sibling())
+            {
+                if(n->type() == node_element)
+                {
+                    rxml_notes_visit(t, n);
+                }
+            }
+        }
+    }
+}
+
+// Moves the children of one element to the end of another
+static void rxml_movechildren(xml_node<> *from, xml_node<> *to)
+{
+    while(xml_node<> *n = from->first_node())
+    {
+        from->remove_first_node();
+        to->append_node(n);
+    }
+}
+
+// A new element with the same name and attributes as node, sharing its
+// strings
+static xml_node<> *rxml_shallowcopy(xml_document<> *doc,
+                                    const xml_node<> *node)
+{
+    xml_node<> *n = doc->allocate_node(node_element, node->name(), 0,
+                                       node->name_size());
+    for(const xml_attribute<> *a = node->first_attribute();
+        a;
+        a = a->next_attribute())
+    {
+        n->append_attribute(doc->allocate_attribute(a->name(), a->value(),
+                                                    a->name_size(),
+                                                    a->value_size()));
+    }
+    return n;
+}
+
+// Tests if two measures have the same number, or both have none
+static bool rxml_samenumber(const xml_node<> *a, const xml_node<> *b)
+{
+    const xml_attribute<> * const na = a->first_attribute("number");
+    const xml_attribute<> * const nb = b->first_attribute("number");
+    return (!na && !nb)
+        || (na && nb && na->value_size() == nb->value_size()
+            && !memcmp(na->value(), nb->value(), na->value_size()));
+}
+
+// Turns a <score-partwise> into a <score-timewise> in place. As in
+// parttime.xsl, measures of different parts are matched by @number,
+// and each timewise <measure> takes the attributes of the first part's
+// measure with that number. Unlike parttime.xsl, measures whose number
+// the first part doesn't have are kept, in timewise measures after the
+// others. Repeated numbers are matched in order. Only the part and
+// measure elements are relinked; their contents are moved, not copied.
+static void rxml_totimewise(xml_document<> *doc, xml_node<> *root)
+{
+    std::vector<xml_node<> *> parts;
+    for(xml_node<> *p = root->first_node("part");
+        p;
+        p = p->next_sibling("part"))
+    {
+        parts.push_back(p);
+    }
+    // measures[j][i] is the measure of part i in timewise measure j,
+    // and numbered[j] the first measure put in it
+    std::vector<std::vector<xml_node<> *> > measures;
+    std::vector<const xml_node<> *> numbered;
+    for(size_t i = 0; i < parts.size(); ++i)
+    {
+        size_t next = 0;
+        for(xml_node<> *m = parts[i]->first_node("measure");
+            m;
+            m = m->next_sibling("measure"))
+        {
+            // look from the last match on, so that parts numbered alike
+            // take one comparison per measure
+            const size_t n = measures.size();
+            size_t j = n;
+            for(size_t k = 0; k < n && j == n; ++k)
+            {
+                const size_t c = (next + k) % n;
+                if(!measures[c][i] && rxml_samenumber(numbered[c], m))
+                {
+                    j = c;
+                }
+            }
+            if(j == n)
+            {
+                measures.push_back(std::vector<xml_node<> *>(parts.size()));
+                numbered.push_back(m);
+            }
+            measures[j][i] = m;
+            next = j + 1;
+        }
+    }
+    for(size_t i = 0; i < parts.size(); ++i)
+    {
+        root->remove_node(parts[i]);
+    }
+    for(size_t j = 0; j < measures.size(); ++j)
+    {
+        xml_node<> *measure = NULL;
+        for(size_t i = 0; i < parts.size(); ++i)
+        {
+            xml_node<> * const m = measures[j][i];
+            if(!m)
+            {
+                continue;
+            }
+            xml_node<> * const p = rxml_shallowcopy(doc, parts[i]);
+            parts[i]->remove_node(m);
+            rxml_movechildren(m, p);
+            if(!measure)
+            {
+                measure = m;
+                root->append_node(measure);
+            }
+            measure->append_node(p);
+        }
+    }
+    root->name("score-timewise");
+}
+
+// Turns a <score-timewise> into a <score-partwise> in place. Parts are
+// matched by id, in the order in which they first appear.
+static void rxml_topartwise(xml_document<> *doc, xml_node<> *root)
+{
+    std::vector<xml_node<> *> measures;
+    for(xml_node<> *m = root->first_node("measure");
+        m;
+        m = m->next_sibling("measure"))
+    {
+        measures.push_back(m);
+    }
+    std::vector<xml_node<> *> parts;
+    std::vector<xml_node<> *> inner;
+    for(size_t j = 0; j < measures.size(); ++j)
+    {
+        xml_node<> * const measure = measures[j];
+        root->remove_node(measure);
+        inner.clear();
+        for(xml_node<> *p = measure->first_node("part");
+            p;
+            p = p->next_sibling("part"))
+        {
+            inner.push_back(p);
+        }
+        for(size_t k = 0; k < inner.size(); ++k)
+        {
+            measure->remove_node(inner[k]);
+        }
+        for(size_t k = 0; k < inner.size(); ++k)
+        {
+            xml_node<> * const p = inner[k];
+            xml_node<> * const m =
+                k ? rxml_shallowcopy(doc, measure) : measure;
+            rxml_movechildren(p, m);
+            xml_node<> *part = NULL;
+            for(size_t i = 0; i < parts.size() && !part; ++i)
+            {
+                if(rxml_sameid(parts[i], p))
+                {
+                    part = parts[i];
+                }
+            }
+            if(!part)
+            {
+                // first appearance: the emptied timewise part becomes
+                // the partwise one
+                part = p;
+                parts.push_back(part);
+                root->append_node(part);
+            }
+            part->append_node(m);
+        }
+    }
+    root->name("score-partwise");
+}
+
+// Converts the score in doc to the orientation selected by
+// @orientation, if it isn't already in it
+static void rxml_orient(rxml *x, xml_document<> *doc)
+{
+    if(x->orientation != ps_partwise && x->orientation != ps_timewise)
+    {
+        return;
+    }
+    xml_node<> * const root = rxml_rootelement(doc->first_node());
+    if(!root)
+    {
+        return;
+    }
+    // the copies are part of the conversion the parse started
+    tracked_arena::scope scope(x->arena);
+    if(x->orientation == ps_timewise && rxml_isnamed(root, "score-partwise"))
+    {
+        rxml_totimewise(doc, root);
+    }
+    else if(x->orientation == ps_partwise
+            && rxml_isnamed(root, "score-timewise"))
+    {
+        rxml_topartwise(doc, root);
+    }
+    x->arena->record(*doc);
+}
+
+// Outputs the note table as "notes <dictname>", a dict with one atom
+// array per column, held in a dictionary owned by the instance.
+static void rxml_outputnotes(rxml *x, rxml_notetable *t)
+{
+    if(!rxml_ownedDict(x, &x->notesdict, &x->notesdictname))
+    {
+        return;
+    }
+    struct { t_symbol *key; std::vector<t_atom> *col; } cols[] = {
+        { ps_part, &t->part }, { ps_measure, &t->measure },
+        { ps_voice, &t->voice }, { ps_step, &t->step },
+        { ps_alter, &t->alter }, { ps_octave, &t->octave },
+        { ps_duration, &t->duration }, { ps_tie, &t->tie },
+        { ps_onset, &t->onset }
+    };
+    for(size_t i = 0; i < sizeof(cols) / sizeof(cols[0]); ++i)
+    {
+        std::vector<t_atom> &col = *(cols[i].col);
+        dictionary_appendatoms(x->notesdict, cols[i].key, (long)col.size(),
+                               col.empty() ? NULL : &col[0]);
+    }
+    t_atom out;
+    atom_setsym(&out, x->notesdictname);
+    outlet_anything(x->outlets[RXML_OUTLET_MAIN], ps_notes, 1, &out);
+}
+
+static t_dictionary *rxml_eventsDict(const std::vector<rxml_event> &events,
+                                     bool notes)
+{
+    t_dictionary *d = dictionary_new();
+    std::vector<t_atom> col(events.size());
+    t_atom * const av = col.empty() ? NULL : &col[0];
+    const long ac = (long)col.size();
+    for(size_t i = 0; i < events.size(); ++i)
+    {
+        atom_setfloat(&col[i], events[i].onset);
+    }
+    dictionary_appendatoms(d, ps_onset, ac, av);
+    for(size_t i = 0; i < events.size(); ++i)
+    {
+        atom_setlong(&col[i], events[i].part);
+    }
+    dictionary_appendatoms(d, ps_part, ac, av);
+    for(size_t i = 0; i < events.size(); ++i)
+    {
+        atom_setlong(&col[i], events[i].measure);
+    }
+    dictionary_appendatoms(d, ps_measure, ac, av);
+    if(notes)
+    {
+        for(size_t i = 0; i < events.size(); ++i)
+        {
+            atom_setlong(&col[i], events[i].note);
+        }
+        dictionary_appendatoms(d, ps_note, ac, av);
+    }
+    return d;
+}
+
+// Keeps the measure starts of a note table for locate and bar, and
+// outputs the time index as "timeindex <dictname>". The dict holds a
+// "notes" dict with onset, part, measure and note columns sorted by
+// onset, and a "measures" dict with onset, part and measure columns.
+static void rxml_outputtimes(rxml *x, rxml_notetable *t)
+{
+    rxml_timeindex *times = new (std::nothrow) rxml_timeindex;
+    if(!times)
+    {
+        object_error((t_object *)x, "Couldn't allocate time index");
+        return;
+    }
+    times->measures.swap(t->times.measures);
+    times->parts.swap(t->times.parts);
+    times->parts.push_back(times->measures.size());
+    // stable, so that simultaneous notes stay in document order
+    std::stable_sort(t->events.begin(), t->events.end(), rxml_event_before);
+    t_dictionary *d = rxml_ownedDict(x, &x->timesdict, &x->timesdictname);
+    if(d)
+    {
+        dictionary_appenddictionary(d, ps_notes, (t_object *)
+                                    rxml_eventsDict(t->events, true));
+        dictionary_appenddictionary(d, ps_measures, (t_object *)
+                                    rxml_eventsDict(times->measures, false));
+    }
+    critical_enter(x->lock);
+    std::swap(x->times, times);
+    critical_exit(x->lock);
+    delete times;
+    if(!d)
+    {
+        return;
+    }
+    t_atom out;
+    atom_setsym(&out, x->timesdictname);
+    outlet_anything(x->outlets[RXML_OUTLET_MAIN], ps_timeindex, 1, &out);
+}
+
+// Outputs "locate <part> <measure> <onset>" for each part, giving the
+// measure that contains the time (in quarter notes) and its start.
+static void rxml_locate(rxml *x, double time)
+{
+    std::vector<rxml_event> found;
+    critical_enter(x->lock);
+    const bool indexed = x->times != NULL;
+    if(x->times)
+    {
+        const std::vector<rxml_event> &m = x->times->measures;
+        const std::vector<size_t> &parts = x->times->parts;
+        const rxml_event key = { time, 0, 0, 0 };
+        for(size_t i = 0; i + 1 < parts.size(); ++i)
+        {
+            const std::vector<rxml_event>::const_iterator first =
+                m.begin() + parts[i];
+            const std::vector<rxml_event>::const_iterator it =
+                std::upper_bound(first, m.begin() + parts[i + 1], key,
+                                 rxml_event_before);
+            if(it != first)
+            {
+                found.push_back(*(it - 1));
+            }
+        }
+    }
+    critical_exit(x->lock);
+    if(!indexed)
+    {
+        object_error((t_object *)x, "no time index, "
+                     "turn on @timeindex and convert a score");
+        return;
+    }
+    for(size_t i = 0; i < found.size(); ++i)
+    {
+        t_atom out[3];
+        atom_setlong(out, found[i].part);
+        atom_setlong(out + 1, found[i].measure);
+        atom_setfloat(out + 2, found[i].onset);
+        outlet_anything(x->outlets[RXML_OUTLET_MAIN], ps_locate, 3, out);
+    }
+}
+
+// Outputs "bar <part> <measure> <onset>" for each part that has the
+// measure, giving the time at which it starts. measure is not the
+// @number of a <measure> but its 0-based position in the part, as in
+// the measure columns of the note table and time index and the output
+// of locate; bar 0 is the first measure, pickup or not.
+static void rxml_bar(rxml *x, long measure)
+{
+    std::vector<rxml_event> found;
+    critical_enter(x->lock);
+    const bool indexed = x->times != NULL;
+    if(x->times && measure >= 0)
+    {
+        const std::vector<rxml_event> &m = x->times->measures;
+        const std::vector<size_t> &parts = x->times->parts;
+        for(size_t i = 0; i + 1 < parts.size(); ++i)
+        {
+            if((size_t)measure < parts[i + 1] - parts[i])
+            {
+                found.push_back(m[parts[i] + measure]);
+            }
+        }
+    }
+    critical_exit(x->lock);
+    if(!indexed)
+    {
+        object_error((t_object *)x, "no time index, "
+                     "turn on @timeindex and convert a score");
+        return;
+    }
+    for(size_t i = 0; i < found.size(); ++i)
+    {
+        t_atom out[3];
+        atom_setlong(out, found[i].part);
+        atom_setlong(out + 1, found[i].measure);
+        atom_setfloat(out + 2, found[i].onset);
+        outlet_anything(x->outlets[RXML_OUTLET_MAIN], ps_bar, 3, out);
+    }
+}
+
+} // extern "C"
+
+// Collects notes while converting a DOM. Compact documents are walked
+// for notes before the DOM they are built from is cleared.
+static void rxml_toJSON_visit(rxml *x, const xml_node<> *node)
+{
+    if(x->notetable)
+    {
+        rxml_notes_visit(x->notetable, node);
+    }
+}
+
+static void rxml_toJSON_visit(rxml *, compact_node<>)
+{
+}
+
+// Starts a note table for the score under root, if @notes or
+// @timeindex want one, and returns it if it is to be filled while the
+// score is converted. A timewise score interleaves its parts, so it is
+// walked here instead, and NULL is returned.
+static rxml_notetable *rxml_notes_begin(rxml *x, rxml_notetable *table,
+                                        const xml_node<> *root)
+{
+    rxml_cursor_init(&(table->cursor));
+    if(!(x->notes || x->timeindex))
+    {
+        return NULL;
+    }
+    if(rxml_isnamed(root, "score-timewise"))
+    {
+        rxml_notes_walk(table, root);
+        return NULL;
+    }
+    return table;
+}
+
+// Tests if rxml_toJSON() should translate entities, which is left to it
+// by rxml_parseranges() unless @parseflags has noentity.
+static bool rxml_decoding(const rxml *x)
+{
+    return !(x->parseflags & 1);
+}
+
+// Adds attribute name="value" to d as "@name". Returns 0 on success.
+static int rxml_toJSON_attribute(rxml *x, t_dictionary *d,
+                                 const char *name, size_t name_size,
+                                 const char *value, size_t value_size)
+{
+    t_symbol * const key = rxml_attrsym(name, name_size);
+    const rxml_cstr text(value, value_size, rxml_decoding(x));
+    t_atom *vals = NULL;
+    long nvals = 0;
+    t_max_err e = atom_setparse(&nvals, &vals, text.str);
+    if(e)
+    {
+        object_error((t_object *)x,
+                     "encountered an error parsing string "
+                     "to atom array");
+        return 1;
+    }
+    if(vals && nvals)
+    {
+        if(nvals == 1)
+        {
+            dictionary_appendatom(d, key, vals);
+        }
+        else
+        {
+            dictionary_appendatoms(d, key, nvals, vals);
+        }
+        sysmem_freeptr(vals);
+    }
+    return 0;
+}
+
+// Adds the attributes of node to d. The parser stores each element's
+// attributes in one array, which is read in order instead of following
+// the links; nodes whose attributes were changed after parsing (by
+// @orientation, for instance) fall back to the list.
+static int rxml_toJSON_attributes(rxml *x, const xml_node<> *node,
+                                  t_dictionary *d)
+{
+    const xml_attribute<> *a = node->first_attribute();
+    const size_t n = node->contiguous_attribute_count();
+    if(n)
+    {
+        for(size_t i = 0; i < n; ++i)
+        {
+            if(rxml_toJSON_attribute(x, d, a[i].name(), a[i].name_size(),
+                                     a[i].value(), a[i].value_size()))
+            {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    for(; a; a = a->next_attribute())
+    {
+        if(rxml_toJSON_attribute(x, d, a->name(), a->name_size(),
+                                 a->value(), a->value_size()))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Attributes of a compact document are always stored contiguously.
+static int rxml_toJSON_attributes(rxml *x, compact_node<> node,
+                                  t_dictionary *d)
+{
+    for(compact_attribute<> a = node->first_attribute();
+        a;
+        a = a->next_attribute())
+    {
+        if(rxml_toJSON_attribute(x, d, a->name(), a->name_size(),
+                                 a->value(), a->value_size()))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Stores a in d under key, or adds it to the atoms already there, so
+// that every text or comment node of an element is kept, in order
+static void rxml_appendpiece(t_dictionary *d, t_symbol *key, t_atom *a)
+{
+    long ac = 0;
+    t_atom *av = NULL;
+    if(dictionary_getatoms(d, key, &ac, &av) || !ac)
+    {
+        dictionary_appendatom(d, key, a);
+        return;
+    }
+    std::vector<t_atom> atoms(av, av + ac);
+    atoms.push_back(*a);
+    dictionary_appendatoms(d, key, (long)atoms.size(), &atoms[0]);
+}
+
+// Converts node alone, without its children, into d. For an element,
+// returns the dict its children go into, or NULL if it has no children
+// or converting it failed.
+// Node is either const xml_node<> * or a compact_node<>, which has
+// the same read interface. Names and values are read as ranges, as left
+// by rxml_parseranges().
+template<class Node>
+static t_dictionary *rxml_toJSON_node(rxml *x, Node node, t_dictionary *d)
+{
+    assert(node);
+    assert(d);
+    const node_type t = node->type();
+    switch(t)
+    {
+    case node_element:
+    {
+        rxml_toJSON_visit(x, node);
+        t_dictionary *thiselem = dictionary_new();
+        t_symbol *thiselem_name = rxml_namesym(node->name(),
+                                               node->name_size());
+        if(dictionary_hasentry(d, thiselem_name))
+        {
+            t_dictionary *parent = NULL;
+            t_max_err e = dictionary_getdictionary(d, thiselem_name,
+                                                   (t_object **)&parent);
+            if(e)
+            {
+                object_error((t_object *)x,
+                             "Error converting to JSON");
+                return NULL;
+            }
+            long nkeys = dictionary_getentrycount(parent);
+            char k[32];
+            snprintf(k, 32, "%ld", nkeys);
+            dictionary_appenddictionary(parent, gensym(k),
+                                        (t_object *)thiselem);
+        }
+        else
+        {
+            t_dictionary *dd = dictionary_new();
+            dictionary_appenddictionary(d, thiselem_name,
+                                        (t_object *)dd);
+            dictionary_appenddictionary(dd, ps_0,
+                                        (t_object *)thiselem);
+        }
+        
+        if(rxml_toJSON_attributes(x, node, thiselem))
+        {
+            return NULL;
+        }
+        return node->first_node() ? thiselem : NULL;
+    }
+    case node_data:
+    case node_cdata:
+    {
+        // entities are not translated inside CDATA sections
+        const rxml_cstr text(node->value(), node->value_size(),
+                             t == node_data && rxml_decoding(x));
+        t_atom a;
+        // stored as a number when typed, so no symbol is created
+        if(!x->typed || t != node_data
+           || rxml_parsenumber(text.str, text.size, &a))
+        {
+            atom_setsym(&a, gensym(text.str));
+        }
+        rxml_appendpiece(d, ps_text, &a);
+    }
+    break;
+    case node_comment:
+    {
+        // only present with @parseflags comments
+        const rxml_cstr text(node->value(), node->value_size(), false);
+        t_atom a;
+        atom_setsym(&a, gensym(text.str));
+        rxml_appendpiece(d, ps_comment, &a);
+    }
+    break;
+    case node_declaration:
+    case node_doctype:
+    case node_pi:
+        break;
+    default:
+        object_error((t_object *)x,
+                     "Encountered unexpected node type: %d",
+                     t);
+        break;
+    }
+    return NULL;
+}
+
+// State of a conversion by rxml_toJSON_step(). The elements being
+// converted are kept on a stack on the heap rather than the call stack,
+// so nesting depth is limited only by memory, and the walk can stop
+// after any node and resume later.
+template<class Node>
+struct rxml_jsonwalk
+{
+    struct frame
+    {
+        Node next;          // next child to convert, null when done
+        t_dictionary *d;    // dict of the element
+        size_t ordering;    // where its children's names start in ordering
+    };
+    std::vector<frame> stack;
+    // names of the child elements of the elements on the stack, each
+    // becoming the element's .ordering once its children are converted
+    std::vector<t_atom> ordering;
+};
+
+// Starts converting the tree under node into d.
+template<class Node>
+static void rxml_toJSON_begin(rxml *x, rxml_jsonwalk<Node> &w,
+                              Node node, t_dictionary *d)
+{
+    w.stack.clear();
+    w.ordering.clear();
+    t_dictionary * const elem = rxml_toJSON_node(x, node, d);
+    if(elem)
+    {
+        typename rxml_jsonwalk<Node>::frame f = {node->first_node(), elem, 0};
+        w.stack.push_back(f);
+    }
+}
+
+// Converts up to n more nodes. Returns 1 if there are nodes left, 0 once
+// the conversion is complete.
+template<class Node>
+static int rxml_toJSON_step(rxml *x, rxml_jsonwalk<Node> &w, long n)
+{
+    while(!w.stack.empty())
+    {
+        typename rxml_jsonwalk<Node>::frame &f = w.stack.back();
+        if(!f.next)
+        {
+            // all children are done
+            const size_t norder = w.ordering.size() - f.ordering;
+            if(norder)
+            {
+                dictionary_appendatoms(f.d, ps_ordering, norder,
+                                       &w.ordering[f.ordering]);
+                w.ordering.resize(f.ordering);
+            }
+            w.stack.pop_back();
+            continue;
+        }
+        if(n-- <= 0)
+        {
+            return 1;
+        }
+        const Node node = f.next;
+        f.next = node->next_sibling();
+        if(node->type() == node_element)
+        {
+            t_atom a;
+            atom_setsym(&a, rxml_namesym(node->name(), node->name_size()));
+            w.ordering.push_back(a);
+        }
+        t_dictionary * const elem = rxml_toJSON_node(x, node, f.d);
+        if(elem)
+        {
+            // f is not used past here, as pushing may move it
+            typename rxml_jsonwalk<Node>::frame child =
+                {node->first_node(), elem, w.ordering.size()};
+            w.stack.push_back(child);
+        }
+    }
+    return 0;
+}
+
+// Converts the tree under node into d in one go.
+template<class Node>
+static void rxml_toJSON(rxml *x, Node node, t_dictionary *d)
+{
+    rxml_jsonwalk<Node> w;
+    rxml_toJSON_begin(x, w, node, d);
+    rxml_toJSON_step(x, w, LONG_MAX);
+}
+
+// Registers rd, the conversion of the tree under root, and outputs
+// "dictionary <name>". Frees rd on failure. Returns 0 on success.
+template<class Node>
+static int rxml_registerdict(rxml *x, Node root, t_dictionary *rd)
+{
+    {
+        // the root node is special--the file cannot contain
+        // multiple copies of it, so it shouldn't have an index
+        t_symbol * const rootname = rxml_namesym(root->name(),
+                                                 root->name_size());
+        t_dictionary *d = NULL;
+        t_max_err e = dictionary_getdictionary(rd,
+                                               rootname,
+                                               (t_object **)&d);
+        if(e)
+        {
+            object_error((t_object *)x,
+                         "error converting to dict: "
+                         "no root node was created (%d)",
+                         e);
+            object_free((t_object *)rd);
+            return 1;
+        }
+        t_dictionary *dd = NULL;
+        e = dictionary_getdictionary(d,
+                                     ps_0,
+                                     (t_object **)&dd);
+        if(e)
+        {
+            object_error((t_object *)x,
+                         "error converting to dict (%d)",
+                         e);
+            object_free((t_object *)rd);
+            return 1;
+        }
+        dictionary_chuckentry(rd, rootname);
+        dictionary_chuckentry(d, ps_0);
+        object_free((t_object *)d);
+        dictionary_appenddictionary(rd,
+                                    rootname,
+                                    (t_object *)dd);
+    }
+    t_symbol *name = NULL;
+    t_dictionary *dd = dictobj_register(rd, &name);
+    if(!dd || !name)
+    {
+        object_error((t_object *)x, "Couldn't register dict");
+        object_free((t_object *)rd);
+        return 1;
+    }
+    t_atom out;
+    atom_setsym(&out, name);
+    outlet_anything(x->outlets[RXML_OUTLET_MAIN],
+                    ps_dictionary, 1, &out);
+    dictobj_release(dd);
+    return 0;
+}
+
+// Converts the tree under root to a new dict and outputs
+// "dictionary <name>". Returns 0 on success.
+template<class Node>
+static int rxml_outputdict(rxml *x, Node root)
+{
+    t_dictionary *rd = dictionary_new();
+    rxml_toJSON(x, root, rd);
+    return rxml_registerdict(x, root, rd);
+}
+
+extern "C" {
+
+// Returns a null-terminated copy of the text received so far, which
+// the caller must free(), or NULL if there is nothing to process.
+static char *rxml_copybuf(rxml *x)
+{
+    critical_enter(x->lock);
+    rxml_drain(x);
+    const size_t bufpos = x->buf ? x->bufpos : 0;
+    char *buf = bufpos ? (char *)malloc(bufpos + 1) : NULL;
+    if(buf)
+    {
+        memcpy(buf, x->buf, bufpos + 1);
+    }
+    critical_exit(x->lock);
+    if(!bufpos)
+    {
+        object_error((t_object *)x, "no text to process");
+        return NULL;
+    }
+    if(!buf)
+    {
+        object_error((t_object *)x,
+                     "Couldn't allocate memory for temporary buffer");
+        return NULL;
+    }
+    return buf;
+}
+
+// Takes the text received so far, which the caller must free(), and
+// gives the instance a new buffer for further text. This lets a message
+// parse the text where it was received, rather than a copy of it, and
+// keeps whatever arrives meanwhile for the next one.
+// Sets *len and returns NULL if there is nothing to process.
+static char *rxml_takebuf(rxml *x, size_t *len)
+{
+    char *fresh = (char *)calloc(RXML_BUFSIZE, 1);
+    if(!fresh)
+    {
+        object_error((t_object *)x,
+                     "Couldn't allocate memory for a new buffer");
+        return NULL;
+    }
+    critical_enter(x->lock);
+    rxml_drain(x);
+    char * const buf = x->buf;
+    const size_t bufpos = x->bufpos;
+    if(buf && bufpos)
+    {
+        x->buf = fresh;
+        x->buflen = RXML_BUFSIZE;
+        x->bufpos = 0;
+    }
+    critical_exit(x->lock);
+    if(!buf || !bufpos)
+    {
+        free(fresh);
+        object_error((t_object *)x, "no text to process");
+        return NULL;
+    }
+    *len = bufpos;
+    return buf;
+}
+
+// Parses buf into doc with the parser at index flags of rxml_parsefns,
+// reporting any error. Returns 0 on success.
+static int rxml_parsecaught(rxml *x, xml_document<> *doc, char *buf,
+                            long flags)
+{
+    const rxml_parsefn parse = rxml_parsefns[flags];
+    // RAPIDXML_NO_EXCEPTIONS is defined in the Xcode project when
+    // building in debug mode, which will cause an assertion to
+    // fire in the case of an error.
+#ifndef RAPIDXML_NO_EXCEPTIONS
+    try{
+        parse(doc, buf);
+    }
+    catch (const std::runtime_error& e)
+    {
+        //std::cerr << "Runtime error was: " << e.what() << std::endl;
+        object_error((t_object *)x, "Runtime error: %s", e.what());
+        return 1;
+    }
+    catch (const rapidxml::parse_error& e)
+    {
+        object_error((t_object *)x, "Parse error: %s", e.what());
+        //std::cerr << "Parse error was: " << e.what() << std::endl;
+        return 1;
+    }
+    catch (const std::exception& e)
+    {
+        object_error((t_object *)x, "Error: %s", e.what());
+        //std::cerr << "Error was: " << e.what() << std::endl;
+        return 1;
+    }
+    catch (...)
+    {
+        object_error((t_object *)x, "Unknown error");
+        // std::cerr << "An unknown error occurred." << std::endl;
+        return 1;
+    }
+#else
+    parse(doc, buf);
+#endif
+    return 0;
+}
+
+// Parses buf into doc as rxml_parsecaught() does, with doc's pool
+// allocating through x->arena, which starts counting anew.
+static int rxml_parsewith(rxml *x, xml_document<> *doc, char *buf,
+                          long flags)
+{
+    x->arena->reset();
+    tracked_arena::track(*doc);
+    tracked_arena::scope scope(x->arena);
+    const int err = rxml_parsecaught(x, doc, buf, flags);
+    x->arena->record(*doc);
+    return err;
+}
+
+// Parses buf into doc in place with the flags selected by @parseflags.
+// Names and values are terminated and have their entities translated.
+static int rxml_parse(rxml *x, xml_document<> *doc, char *buf)
+{
+    return rxml_parsewith(x, doc, buf, x->parseflags);
+}
+
+// Parses buf into doc with the flags selected by @parseflags, but
+// without writing terminators or translating entities, so that only
+// @parseflags normalize modifies buf. Names and values are ranges in
+// buf, which rxml_toJSON() reads with name_size() and value_size(),
+// decoding entities only in the values that contain any.
+static int rxml_parseranges(rxml *x, xml_document<> *doc, char *buf)
+{
+    return rxml_parsewith(x, doc, buf, x->parseflags | RXML_PARSE_RANGES);
+}
+
+// Converts doc through a compact_document, clearing the DOM first so
+// that only the smaller copy is held during the conversion. len is the
+// length of the text doc was parsed from. Returns 0 on success.
+static int rxml_outputcompact(rxml *x, xml_document<> *doc,
+                              const char *buf, size_t len)
+{
+    compact_document<> cd;
+    if(!cd.build(*doc, buf, len))
+    {
+        object_error((t_object *)x,
+                     "document is too large for @compact");
+        return 1;
+    }
+    if(x->notetable)
+    {
+        rxml_notes_walk(x->notetable, rxml_rootelement(doc->first_node()));
+    }
+    doc->clear();
+    return rxml_outputdict(x, rxml_rootelement(cd.first_node()));
+}
+
+// A conversion to a dict done a slice at a time by rxml_slice_run()
+struct rxml_slicejob
+{
+    xml_document<> doc;
+    char *buf;
+    xml_node<> *root;
+    t_dictionary *rd;
+    rxml_jsonwalk<xml_node<> *> walk;
+    rxml_notetable table;
+    // the table, if it is filled as the nodes are converted
+    rxml_notetable *visit;
+    // nodes under root, and how many have been converted
+    size_t total, done;
+};
+
+// Number of nodes under root
+static size_t rxml_countnodes(const xml_node<> *root)
+{
+    size_t n = 0;
+    const xml_node<> *node = root->first_node();
+    while(node)
+    {
+        ++n;
+        if(node->first_node())
+        {
+            node = node->first_node();
+            continue;
+        }
+        while(node != root && !node->next_sibling())
+        {
+            node = node->parent();
+        }
+        node = node == root ? NULL : node->next_sibling();
+    }
+    return n;
+}
+
+// Drops the conversion in progress, if any.
+static void rxml_slice_cancel(rxml *x)
+{
+    rxml_slicejob * const j = x->slicejob;
+    if(!j)
+    {
+        return;
+    }
+    qelem_unset(x->sliceq);
+    x->slicejob = NULL;
+    if(j->rd)
+    {
+        object_free((t_object *)j->rd);
+    }
+    j->doc.clear();
+    free(j->buf);
+    delete j;
+}
+
+// Parses buf and starts converting it a slice at a time, replacing any
+// conversion in progress. Takes ownership of buf. Like the rest of the
+// job, this only runs on the main thread, from sliceq.
+static void rxml_slice_begin(rxml *x, char *buf)
+{
+    rxml_slice_cancel(x);
+    rxml_slicejob *j = new (std::nothrow) rxml_slicejob;
+    if(!j)
+    {
+        object_error((t_object *)x, "Couldn't allocate document");
+        free(buf);
+        return;
+    }
+    j->buf = buf;
+    j->rd = NULL;
+    if(rxml_parseranges(x, &j->doc, buf))
+    {
+        free(buf);
+        delete j;
+        return;
+    }
+    rxml_orient(x, &j->doc);
+    j->root = rxml_rootelement(j->doc.first_node());
+    if(!j->root)
+    {
+        object_error((t_object *)x, "No root!");
+        j->doc.clear();
+        free(buf);
+        delete j;
+        return;
+    }
+    j->visit = rxml_notes_begin(x, &j->table, j->root);
+    j->total = std::max(rxml_countnodes(j->root), (size_t)1);
+    j->done = 0;
+    j->rd = dictionary_new();
+    x->notetable = j->visit;
+    rxml_toJSON_begin(x, j->walk, j->root, j->rd);
+    x->notetable = NULL;
+    x->slicejob = j;
+    outlet_float(x->outlets[RXML_OUTLET_PROGRESS], 0.);
+    if(x->slicejob == j)
+    {
+        qelem_set(x->sliceq);
+    }
+}
+
+// Converts nodes of x->slicejob for up to x->slice milliseconds, then
+// reports the percentage done from the progress outlet and reschedules
+// itself, so the conversion never holds up the main thread for long.
+// Outputs the dict once every node is converted. Text handed over by
+// rxml_bang() is parsed first, replacing the conversion in progress.
+static void rxml_slice_run(rxml *x)
+{
+    critical_enter(x->lock);
+    char * const buf = x->slicebuf;
+    x->slicebuf = NULL;
+    critical_exit(x->lock);
+    if(buf)
+    {
+        rxml_slice_begin(x, buf);
+        return;
+    }
+    rxml_slicejob * const j = x->slicejob;
+    if(!j)
+    {
+        return;
+    }
+    const double start = systimer_gettime();
+    x->notetable = j->visit;
+    int more;
+    while((more = rxml_toJSON_step(x, j->walk, RXML_SLICE_NODES)))
+    {
+        j->done += RXML_SLICE_NODES;
+        if(systimer_gettime() - start >= x->slice)
+        {
+            break;
+        }
+    }
+    x->notetable = NULL;
+    if(more)
+    {
+        // j may be cancelled by whatever the progress reaches
+        qelem_set(x->sliceq);
+        outlet_float(x->outlets[RXML_OUTLET_PROGRESS],
+                     std::min(99., 100. * j->done / j->total));
+        return;
+    }
+    x->slicejob = NULL;
+    outlet_float(x->outlets[RXML_OUTLET_PROGRESS], 100.);
+    t_dictionary * const rd = j->rd;
+    j->rd = NULL;
+    if(!rxml_registerdict(x, j->root, rd))
+    {
+        if(x->notes)
+        {
+            rxml_outputnotes(x, &j->table);
+        }
+        if(x->timeindex)
+        {
+            rxml_outputtimes(x, &j->table);
+        }
+    }
+    j->doc.clear();
+    free(j->buf);
+    delete j;
+}
+
+static void rxml_bang(rxml *x)
+{
+    size_t len = 0;
+    char *buf = rxml_takebuf(x, &len);
+    if(!buf)
+    {
+        return;
+    }
+    if(x->slice > 0 && !x->compact)
+    {
+        // the job belongs to the main thread, whichever thread banged
+        critical_enter(x->lock);
+        std::swap(x->slicebuf, buf);
+        critical_exit(x->lock);
+        free(buf);
+        qelem_set(x->sliceq);
+        return;
+    }
+    
+    xml_document<> doc;
+    if(rxml_parseranges(x, &doc, buf))
+    {
+        free(buf);
+        return;
+    }
+    rxml_orient(x, &doc);
+    rxml_notetable table;
+    
+    xml_node<> *root = rxml_rootelement(doc.first_node());
+    if(!root)
+    {
+        object_error((t_object *)x, "No root!");
+        goto cleanup;
+    }
+    else
+    {
+        x->notetable = rxml_notes_begin(x, &table, root);
+        const int err = x->compact
+            ? rxml_outputcompact(x, &doc, buf, len)
+            : rxml_outputdict(x, root);
+        x->notetable = NULL;
+        if(err)
+        {
+            goto cleanup;
+        }
+        if(x->notes)
+        {
+            rxml_outputnotes(x, &table);
+        }
+        if(x->timeindex)
+        {
+            rxml_outputtimes(x, &table);
+        }
+    }
+cleanup:
+    doc.clear();
+    free(buf);
+}
+
+// Hashes an element whose child elements are hashed already
+static uint64_t rxml_diff_hashone(rxml_diffctx *ctx, const xml_node<> *node)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    const char t = (char)node->type();
+    h = rxml_hashbytes(h, &t, 1);
+    h = rxml_hashrange(h, node->name(), node->name_size());
+    h = rxml_hashrange(h, node->value(), node->value_size());
+    for(const xml_attribute<> *a = node->first_attribute();
+        a;
+        a = a->next_attribute())
+    {
+        h = rxml_hashrange(h, a->name(), a->name_size());
+        h = rxml_hashrange(h, a->value(), a->value_size());
+    }
+    for(const xml_node<> *n = node->first_node();
+        n;
+        n = n->next_sibling())
+    {
+        if(n->type() == node_element)
+        {
+            const uint64_t ch = ctx->hashes[n];
+            h = rxml_hashbytes(h, (const char *)&ch, sizeof(ch));
+        }
+    }
+    return h;
+}
+
+// Hash of an element's name, attributes, text and child elements,
+// memoized so that each subtree is only hashed once per diff. Elements
+// are hashed after their children, from a stack of their own.
+static uint64_t rxml_diff_hash(rxml_diffctx *ctx, const xml_node<> *node)
+{
+    std::unordered_map<const xml_node<> *, uint64_t>::iterator it =
+        ctx->hashes.find(node);
+    if(it != ctx->hashes.end())
+    {
+        return it->second;
+    }
+    std::vector<const xml_node<> *> stack(1, node);
+    while(!stack.empty())
+    {
+        const xml_node<> * const top = stack.back();
+        bool ready = true;
+        for(const xml_node<> *n = top->first_node();
+            n;
+            n = n->next_sibling())
+        {
+            if(n->type() == node_element && !ctx->hashes.count(n))
+            {
+                stack.push_back(n);
+                ready = false;
+            }
+        }
+        if(ready)
+        {
+            ctx->hashes[top] = rxml_diff_hashone(ctx, top);
+            stack.pop_back();
+        }
+    }
+    return ctx->hashes[node];
+}
+
+// Adds an edit to the script, see rxml_diffedit
+static void rxml_diff_edit(rxml_diffctx *ctx,
+                           t_symbol *op,
+                           const std::string &path,
+                           t_symbol *arg1,
+                           t_symbol *arg2,
+                           const xml_node<> *node)
+{
+    std::vector<rxml_diffedit> &v =
+        op == ps_remove ? ctx->removes : ctx->edits;
+    v.push_back(rxml_diffedit());
+    rxml_diffedit &e = v.back();
+    e.op = op;
+    e.path = path;
+    e.arg1 = arg1;
+    e.arg2 = arg2;
+    e.node = node;
+}
+
+// Outputs an edit as "diff <op> <path> ...". An insert is output as
+// "diff insert <path> <dictname>", the dict holding the XML of the node
+// as a string under "insert". The dict is owned by the instance and
+// reused for every insert, so no symbol is made of the XML.
+static void rxml_diff_emit(rxml_diffctx *ctx, const rxml_diffedit &e)
+{
+    rxml *x = ctx->x;
+    t_atom out[4];
+    short ac = 2;
+    atom_setsym(out, e.op);
+    atom_setsym(out + 1, gensym(e.path.c_str()));
+    if(e.node)
+    {
+        std::string s;
+        print(std::back_inserter(s), *e.node, print_no_indenting);
+        if(!rxml_ownedDict(x, &x->diffdict, &x->diffdictname))
+        {
+            return;
+        }
+        dictionary_appendstring(x->diffdict, ps_insert, s.c_str());
+        atom_setsym(out + ac++, x->diffdictname);
+    }
+    if(e.arg1)
+    {
+        atom_setsym(out + ac++, e.arg1);
+    }
+    if(e.arg2)
+    {
+        atom_setsym(out + ac++, e.arg2);
+    }
+    outlet_anything(x->outlets[RXML_OUTLET_MAIN], ps_diff, ac, out);
+    ++(ctx->nedits);
+}
+
+// Outputs the script in an order in which it can be applied edit by
+// edit: first the removes, addressed in the old document, from the last
+// in document order to the first, so that no remove shifts the index
+// of one still to come; then the inserts and the value and attribute
+// edits, addressed in the new document, in its document order, so that
+// whatever precedes a node in the new document is in place when it is
+// reached. An insert at index n goes before the element of that name
+// now at index n, or else after the last one.
+static void rxml_diff_output(rxml_diffctx *ctx)
+{
+    for(size_t i = ctx->removes.size(); i-- > 0;)
+    {
+        rxml_diff_emit(ctx, ctx->removes[i]);
+    }
+    for(size_t i = 0; i < ctx->edits.size(); ++i)
+    {
+        rxml_diff_emit(ctx, ctx->edits[i]);
+    }
+}
+
+// Collects the element children of node along with their index
+// among same-named siblings, which is how rxml_toJSON addresses them.
+static void rxml_diff_children(const xml_node<> *node,
+                               std::vector<const xml_node<> *> &children,
+                               std::vector<long> &indices)
+{
+    std::map<std::string, long> counts;
+    for(const xml_node<> *n = node->first_node();
+        n;
+        n = n->next_sibling())
+    {
+        if(n->type() == node_element)
+        {
+            children.push_back(n);
+            indices.push_back(counts[std::string(n->name(),
+                                                 n->name_size())]++);
+        }
+    }
+}
+
+static std::string rxml_diff_path(const std::string &parent,
+                                  const xml_node<> *node,
+                                  long index)
+{
+    char buf[32];
+    snprintf(buf, 32, "/%ld", index);
+    return parent + "/" + std::string(node->name(), node->name_size()) + buf;
+}
+
+static bool rxml_diff_samename(const xml_node<> *a, const xml_node<> *b)
+{
+    return a->name_size() == b->name_size()
+        && !memcmp(a->name(), b->name(), a->name_size());
+}
+
+static void rxml_diff_addstep(std::vector<rxml_diffstep> &steps, int op,
+                              const xml_node<> *a, const xml_node<> *b,
+                              const std::string &apath,
+                              const std::string &bpath)
+{
+    steps.push_back(rxml_diffstep());
+    rxml_diffstep &s = steps.back();
+    s.op = op;
+    s.a = a;
+    s.b = b;
+    s.apath = apath;
+    s.bpath = bpath;
+}
+
+// Diffs two runs of children that share no exact subtree matches:
+// same-named elements are paired in order to be compared, everything
+// else is to be reported as removed or inserted. Adds the steps, in
+// order, to steps.
+static void rxml_diff_gap(const std::vector<const xml_node<> *> &A,
+                          const std::vector<long> &ai,
+                          size_t alo, size_t ahi,
+                          const std::vector<const xml_node<> *> &B,
+                          const std::vector<long> &bi,
+                          size_t blo, size_t bhi,
+                          const std::string &apath,
+                          const std::string &bpath,
+                          std::vector<rxml_diffstep> &steps)
+{
+    size_t i = alo;
+    for(size_t j = blo; j < bhi; ++j)
+    {
+        size_t k = i;
+        while(k < ahi && !rxml_diff_samename(A[k], B[j]))
+        {
+            ++k;
+        }
+        if(k == ahi)
+        {
+            rxml_diff_addstep(steps, RXML_DIFF_INSERT, NULL, B[j], "",
+                              rxml_diff_path(bpath, B[j], bi[j]));
+            continue;
+        }
+        for(; i < k; ++i)
+        {
+            rxml_diff_addstep(steps, RXML_DIFF_REMOVE, A[i], NULL,
+                              rxml_diff_path(apath, A[i], ai[i]), "");
+        }
+        rxml_diff_addstep(steps, RXML_DIFF_COMPARE, A[k], B[j],
+                          rxml_diff_path(apath, A[k], ai[k]),
+                          rxml_diff_path(bpath, B[j], bi[j]));
+        i = k + 1;
+    }
+    for(; i < ahi; ++i)
+    {
+        rxml_diff_addstep(steps, RXML_DIFF_REMOVE, A[i], NULL,
+                          rxml_diff_path(apath, A[i], ai[i]), "");
+    }
+}
+
+// Compares two elements with the same name, outputting the edits to
+// their attributes and text, and adds the steps that diff their
+// children to steps.
+static void rxml_diff_compare(rxml_diffctx *ctx,
+                              const xml_node<> *a,
+                              const xml_node<> *b,
+                              const std::string &apath,
+                              const std::string &bpath,
+                              std::vector<rxml_diffstep> &steps)
+{
+    if(rxml_diff_hash(ctx, a) == rxml_diff_hash(ctx, b))
+    {
+        return;
+    }
+
+    // attributes
+    for(const xml_attribute<> *ba = b->first_attribute();
+        ba;
+        ba = ba->next_attribute())
+    {
+        const xml_attribute<> *aa =
+            a->first_attribute(ba->name(), ba->name_size());
+        if(!aa || aa->value_size() != ba->value_size()
+           || memcmp(aa->value(), ba->value(), ba->value_size()))
+        {
+            rxml_diff_edit(ctx, ps_attr, bpath,
+                           gensym(ba->name()), gensym(ba->value()), NULL);
+        }
+    }
+    for(const xml_attribute<> *aa = a->first_attribute();
+        aa;
+        aa = aa->next_attribute())
+    {
+        if(!b->first_attribute(aa->name(), aa->name_size()))
+        {
+            rxml_diff_edit(ctx, ps_removeattr, bpath,
+                           gensym(aa->name()), NULL, NULL);
+        }
+    }
+
+    // text
+    if(a->value_size() != b->value_size()
+       || memcmp(a->value(), b->value(), b->value_size()))
+    {
+        rxml_diff_edit(ctx, ps_value, bpath, gensym(b->value()), NULL,
+                       NULL);
+    }
+
+    // children: strip the common prefix and suffix, align the rest on
+    // identical subtrees, and recurse into what lies in between
+    std::vector<const xml_node<> *> A, B;
+    std::vector<long> ai, bi;
+    rxml_diff_children(a, A, ai);
+    rxml_diff_children(b, B, bi);
+    size_t n = A.size(), m = B.size();
+    size_t p = 0;
+    while(p < n && p < m
+          && rxml_diff_hash(ctx, A[p]) == rxml_diff_hash(ctx, B[p]))
+    {
+        ++p;
+    }
+    size_t s = 0;
+    while(s < n - p && s < m - p
+          && rxml_diff_hash(ctx, A[n - 1 - s])
+             == rxml_diff_hash(ctx, B[m - 1 - s]))
+    {
+        ++s;
+    }
+    const size_t an = n - p - s, bn = m - p - s;
+    std::vector<std::pair<size_t, size_t> > anchors;
+    if(an && bn && (an + 1) * (bn + 1) <= RXML_DIFF_MAXLCS)
+    {
+        std::vector<uint32_t> lcs((an + 1) * (bn + 1), 0);
+        for(size_t i = an; i-- > 0;)
+        {
+            for(size_t j = bn; j-- > 0;)
+            {
+                uint32_t *c = &lcs[i * (bn + 1) + j];
+                if(rxml_diff_hash(ctx, A[p + i])
+                   == rxml_diff_hash(ctx, B[p + j]))
+                {
+                    *c = lcs[(i + 1) * (bn + 1) + j + 1] + 1;
+                }
+                else
+                {
+                    *c = std::max(lcs[(i + 1) * (bn + 1) + j],
+                                  lcs[i * (bn + 1) + j + 1]);
+                }
+            }
+        }
+        size_t i = 0, j = 0;
+        while(i < an && j < bn)
+        {
+            if(rxml_diff_hash(ctx, A[p + i]) == rxml_diff_hash(ctx, B[p + j]))
+            {
+                anchors.push_back(std::make_pair(p + i, p + j));
+                ++i;
+                ++j;
+            }
+            else if(lcs[(i + 1) * (bn + 1) + j] >= lcs[i * (bn + 1) + j + 1])
+            {
+                ++i;
+            }
+            else
+            {
+                ++j;
+            }
+        }
+    }
+    anchors.push_back(std::make_pair(n - s, m - s));
+    size_t alo = p, blo = p;
+    for(size_t k = 0; k < anchors.size(); ++k)
+    {
+        rxml_diff_gap(A, ai, alo, anchors[k].first,
+                      B, bi, blo, anchors[k].second, apath, bpath, steps);
+        alo = anchors[k].first + 1;
+        blo = anchors[k].second + 1;
+    }
+}
+
+// Compares two elements with the same name, descending into their
+// children in document order from a stack of steps rather than by
+// recursion, and adds the edits to the script. Paths of removed nodes
+// refer to the old document, all other paths to the new one.
+static void rxml_diff_node(rxml_diffctx *ctx,
+                           const xml_node<> *a,
+                           const xml_node<> *b,
+                           const std::string &apath,
+                           const std::string &bpath)
+{
+    std::vector<rxml_diffstep> stack, steps;
+    rxml_diff_addstep(stack, RXML_DIFF_COMPARE, a, b, apath, bpath);
+    while(!stack.empty())
+    {
+        rxml_diffstep s;
+        std::swap(s, stack.back());
+        stack.pop_back();
+        switch(s.op)
+        {
+        case RXML_DIFF_REMOVE:
+            rxml_diff_edit(ctx, ps_remove, s.apath, NULL, NULL, NULL);
+            break;
+        case RXML_DIFF_INSERT:
+            rxml_diff_edit(ctx, ps_insert, s.bpath, NULL, NULL, s.b);
+            break;
+        case RXML_DIFF_COMPARE:
+            steps.clear();
+            rxml_diff_compare(ctx, s.a, s.b, s.apath, s.bpath, steps);
+            // last first, so that the first is taken next
+            while(!steps.empty())
+            {
+                stack.push_back(rxml_diffstep());
+                std::swap(stack.back(), steps.back());
+                steps.pop_back();
+            }
+            break;
+        }
+    }
+}
+
+// Diffs the accumulated text against the document received by the
+// previous diff and outputs the edit script, one "diff" message per
+// edit in the order of rxml_diff_output(), followed by
+// "diff done <count>".
+static void rxml_diff(rxml *x)
+{
+    size_t len = 0;
+    char *buf = rxml_takebuf(x, &len);
+    if(!buf)
+    {
+        return;
+    }
+    xml_document<> *doc = new (std::nothrow) xml_document<>;
+    if(!doc)
+    {
+        object_error((t_object *)x, "Couldn't allocate document");
+        free(buf);
+        return;
+    }
+    if(rxml_parse(x, doc, buf))
+    {
+        delete doc;
+        free(buf);
+        return;
+    }
+
+    const xml_node<> *b = rxml_rootelement(doc->first_node());
+    if(!b)
+    {
+        object_error((t_object *)x, "No root!");
+        delete doc;
+        free(buf);
+        return;
+    }
+    rxml_diffctx ctx;
+    ctx.x = x;
+    ctx.nedits = 0;
+    const xml_node<> *a =
+        x->diffdoc ? rxml_rootelement(x->diffdoc->first_node()) : NULL;
+    // the root node has no index, as in the dict
+    const std::string bpath = std::string("/") + b->name();
+    if(a && rxml_diff_samename(a, b))
+    {
+        rxml_diff_node(&ctx, a, b, bpath, bpath);
+    }
+    else
+    {
+        if(a)
+        {
+            rxml_diff_edit(&ctx, ps_remove,
+                           std::string("/") + a->name(), NULL, NULL,
+                           NULL);
+        }
+        rxml_diff_edit(&ctx, ps_insert, bpath, NULL, NULL, b);
+    }
+    rxml_diff_output(&ctx);
+    t_atom out[2];
+    atom_setsym(out, ps_done);
+    atom_setlong(out + 1, ctx.nedits);
+    outlet_anything(x->outlets[RXML_OUTLET_MAIN], ps_diff, 2, out);
+
+    // the new document becomes the reference for the next diff
+    delete x->diffdoc;
+    free(x->diffbuf);
+    x->diffdoc = doc;
+    x->diffbuf = buf;
+}
+
+// Returns a pointer just past the next occurrence of lit, or NULL
+static const char *rxml_skippast(const char *p, const char *end,
+                                 const char *lit)
+{
+    const size_t n = strlen(lit);
+    while((p = (const char *)memchr(p, lit[0], end - p)))
+    {
+        if((size_t)(end - p) < n)
+        {
+            return NULL;
+        }
+        if(!memcmp(p, lit, n))
+        {
+            return p + n;
+        }
+        ++p;
+    }
+    return NULL;
+}
+
+static bool rxml_startswith(const char *p, const char *end,
+                            const char *lit)
+{
+    const size_t n = strlen(lit);
+    return (size_t)(end - p) >= n && !memcmp(p, lit, n);
+}
+
+// True if the tag at p has the given name
+static bool rxml_tagnamed(const char *p, const char *end,
+                          const char *name)
+{
+    const size_t n = strlen(name);
+    if((size_t)(end - p) <= n + 1 || memcmp(p + 1, name, n))
+    {
+        return false;
+    }
+    const char c = p[n + 1];
+    return c == '>' || c == '/' || c == ' ' || c == '\t'
+        || c == '\n' || c == '\r';
+}
+
+// Scans the text for the offsets of the root element and of the
+// <part> and <measure> elements below it, without parsing. Returns 0
+// on success.
+static int rxml_scanindex(const char *buf, size_t len,
+                          rxml_measureindex *idx)
+{
+    const char *p = buf;
+    const char * const end = buf + len;
+    long depth = 0;
+    bool inpart = false, inmeasure = false, sawroot = false;
+    idx->srclen = len;
+    idx->parts.clear();
+    while(p && (p = (const char *)memchr(p, '<', end - p)))
+    {
+        const size_t start = p - buf;
+        if(rxml_startswith(p, end, "<!--"))
+        {
+            p = rxml_skippast(p + 4, end, "-->");
+        }
+        else if(rxml_startswith(p, end, "<![CDATA["))
+        {
+            p = rxml_skippast(p + 9, end, "]]>");
+        }
+        else if(rxml_startswith(p, end, "<?"))
+        {
+            p = rxml_skippast(p + 2, end, "?>");
+        }
+        else if(rxml_startswith(p, end, "<!"))
+        {
+            // doctype, possibly with an internal subset
+            long brackets = 0;
+            for(++p; p < end; ++p)
+            {
+                if(*p == '[')
+                {
+                    ++brackets;
+                }
+                else if(*p == ']')
+                {
+                    --brackets;
+                }
+                else if(*p == '>' && brackets <= 0)
+                {
+                    break;
+                }
+            }
+            p = p < end ? p + 1 : NULL;
+        }
+        else if(rxml_startswith(p, end, "</"))
+        {
+            p = (const char *)memchr(p, '>', end - p);
+            if(!p || depth <= 0)
+            {
+                return 1;
+            }
+            ++p;
+            if(depth == 3 && inmeasure)
+            {
+                idx->parts.back().measures.back().end = p - buf;
+                inmeasure = false;
+            }
+            else if(depth == 2 && inpart)
+            {
+                idx->parts.back().part.end = p - buf;
+                inpart = false;
+            }
+            else if(depth == 1)
+            {
+                idx->root.end = p - buf;
+            }
+            --depth;
+        }
+        else
+        {
+            // start tag; '>' may appear inside attribute values
+            const char *q = p + 1;
+            char quote = 0;
+            for(; q < end; ++q)
+            {
+                if(quote)
+                {
+                    quote = *q == quote ? 0 : quote;
+                }
+                else if(*q == '"' || *q == '\'')
+                {
+                    quote = *q;
+                }
+                else if(*q == '>')
+                {
+                    break;
+                }
+            }
+            if(q == end)
+            {
+                return 1;
+            }
+            const bool empty = q[-1] == '/';
+            const size_t head = q + 1 - buf;
+            const rxml_range r = { start, head, empty ? head : 0 };
+            const long level = depth + 1;
+            if(level == 1 && !sawroot)
+            {
+                idx->root = r;
+                sawroot = true;
+            }
+            else if(level == 2 && rxml_tagnamed(p, end, "part"))
+            {
+                rxml_partrange part;
+                part.part = r;
+                idx->parts.push_back(part);
+                inpart = !empty;
+            }
+            else if(level == 3 && inpart
+                    && rxml_tagnamed(p, end, "measure"))
+            {
+                idx->parts.back().measures.push_back(r);
+                inmeasure = !empty;
+            }
+            if(!empty)
+            {
+                ++depth;
+            }
+            p = q + 1;
+        }
+    }
+    return (depth || !sawroot) ? 1 : 0;
+}
+
+static bool rxml_rangeok(const rxml_range &r, size_t len)
+{
+    return r.start < r.head && r.head <= r.end && r.end <= len;
+}
+
+// Whether a range ends where its element does: just past the '>' of
+// an end tag with the name of the start tag, or, for an empty element,
+// at the "/>" of the start tag. The range must be rxml_rangeok().
+static bool rxml_rangecloses(const char *buf, const rxml_range &r)
+{
+    const char * const name = buf + r.start + 1;
+    const size_t n = strcspn(name, " \t\r\n/>");
+    if(r.end == r.head)
+    {
+        return r.head - r.start >= n + 3 && buf[r.head - 2] == '/';
+    }
+    const char *p = buf + r.end - 1;
+    if(*p != '>')
+    {
+        return false;
+    }
+    while(p > buf + r.head && rxml_isspace(p[-1]))
+    {
+        --p;
+    }
+    return (size_t)(p - (buf + r.head)) >= n + 2
+        && !memcmp(p - n, name, n) && p[-n - 1] == '/' && p[-n - 2] == '<';
+}
+
+// Cheap check that an index, possibly read from a file, describes the
+// text: the lengths agree, and every range starts with the right tag
+// and ends with the matching end tag
+static bool rxml_checkindex(const rxml_measureindex *idx,
+                            const char *buf, size_t len)
+{
+    if(idx->srclen != len || !rxml_rangeok(idx->root, len)
+       || buf[idx->root.start] != '<' || !rxml_rangecloses(buf, idx->root))
+    {
+        return false;
+    }
+    const char * const end = buf + len;
+    for(size_t i = 0; i < idx->parts.size(); ++i)
+    {
+        const rxml_partrange &part = idx->parts[i];
+        if(!rxml_rangeok(part.part, len)
+           || !rxml_tagnamed(buf + part.part.start, end, "part")
+           || !rxml_rangecloses(buf, part.part))
+        {
+            return false;
+        }
+        for(size_t j = 0; j < part.measures.size(); ++j)
+        {
+            const rxml_range &m = part.measures[j];
+            if(!rxml_rangeok(m, len)
+               || !rxml_tagnamed(buf + m.start, end, "measure")
+               || !rxml_rangecloses(buf, m))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Scans the text in buf into a new measure index, or returns NULL after
+// reporting why it couldn't
+static rxml_measureindex *rxml_buildindex(rxml *x, const char *buf,
+                                          size_t len)
+{
+    rxml_measureindex *idx = new (std::nothrow) rxml_measureindex;
+    if(!idx)
+    {
+        object_error((t_object *)x, "Couldn't allocate measure index");
+        return NULL;
+    }
+    if(rxml_scanindex(buf, len, idx))
+    {
+        object_error((t_object *)x, "couldn't index measures: "
+                     "the text is not well formed");
+        delete idx;
+        return NULL;
+    }
+    return idx;
+}
+
+// Makes idx the measure index if it describes the text received so far
+// and the current index doesn't, so that an index built from older text
+// never replaces one that matches. Called with x->lock held. Returns
+// the index that is no longer needed, for the caller to delete.
+static rxml_measureindex *rxml_installindex(rxml *x, rxml_measureindex *idx)
+{
+    const size_t len = x->buf ? x->bufpos : 0;
+    if(rxml_checkindex(idx, x->buf, len)
+       && !(x->mindex && rxml_checkindex(x->mindex, x->buf, len)))
+    {
+        std::swap(x->mindex, idx);
+    }
+    return idx;
+}
+
+// Makes x->mindex describe the text received so far, rescanning it
+// unless it already does, and returns it with x->lock held, so that its
+// ranges can be read from x->buf before critical_exit(). Returns NULL,
+// with the lock released, on failure.
+static const rxml_measureindex *rxml_lockindex(rxml *x)
+{
+    for(;;)
+    {
+        critical_enter(x->lock);
+        rxml_drain(x);
+        const size_t len = x->buf ? x->bufpos : 0;
+        if(len && x->mindex && rxml_checkindex(x->mindex, x->buf, len))
+        {
+            return x->mindex;
+        }
+        // scan a copy, so that text can still be received meanwhile
+        char *buf = len ? (char *)malloc(len + 1) : NULL;
+        if(buf)
+        {
+            memcpy(buf, x->buf, len + 1);
+        }
+        critical_exit(x->lock);
+        if(!len)
+        {
+            object_error((t_object *)x, "no text to process");
+            return NULL;
+        }
+        if(!buf)
+        {
+            object_error((t_object *)x,
+                         "Couldn't allocate memory for temporary buffer");
+            return NULL;
+        }
+        rxml_measureindex *idx = rxml_buildindex(x, buf, len);
+        free(buf);
+        if(!idx)
+        {
+            return NULL;
+        }
+        // if more text came in, this finds the index stale and rescans
+        critical_enter(x->lock);
+        idx = rxml_installindex(x, idx);
+        critical_exit(x->lock);
+        delete idx;
+    }
+}
+
+
+// Parses measures from through to (0-based, inclusive) of a part of
+// the accumulated text and outputs them as "dictionary <name>", with
+// the same shape as a whole score that has only that part and those
+// measures. Earlier measures are not read, so their attributes (e.g.
+// divisions) do not carry over. The text is kept, so that other
+// measures can be requested until it is cleared.
+static void rxml_parsemeasures(rxml *x, long part, long from, long to)
+{
+    const rxml_measureindex * const idx = rxml_lockindex(x);
+    if(!idx)
+    {
+        return;
+    }
+    // only the slice is copied, while the text can't change under it
+    std::string slice;
+    const char * const buf = x->buf;
+    if(part >= 0 && part < (long)idx->parts.size())
+    {
+        const rxml_partrange &p = idx->parts[part];
+        const long nmeasures = (long)p.measures.size();
+        if(to >= nmeasures)
+        {
+            to = nmeasures - 1;
+        }
+        if(from >= 0 && from <= to)
         {
-            object_error((t_object *)x,
-                         "malformed dictionary: "
-                         "more than one root node");
-            goto cleanup;
+            const char *root = buf + idx->root.start;
+            const size_t rootnamelen = strcspn(root + 1, " \t\r\n/>");
+            slice.reserve(p.measures[to].end - p.measures[from].start + 256);
+            slice.append(root, idx->root.head - idx->root.start);
+            slice.append(buf + p.part.start, p.part.head - p.part.start);
+            slice.append(buf + p.measures[from].start,
+                         p.measures[to].end - p.measures[from].start);
+            slice.append("</part></");
+            slice.append(root + 1, rootnamelen);
+            slice.append(">");
         }
-        e = dictionary_getatom(d, keys[0], &val);
-        if(e != MAX_ERR_NONE)
+    }
+    critical_exit(x->lock);
+    if(slice.empty())
+    {
+        object_error((t_object *)x, "parsemeasures: no measures %ld to %ld "
+                     "in part %ld", from, to, part);
+        return;
+    }
+
+    xml_document<> doc;
+    if(!rxml_parseranges(x, &doc, &slice[0]))
+    {
+        rxml_orient(x, &doc);
+        const xml_node<> *root = rxml_rootelement(doc.first_node());
+        if(root)
         {
-            object_error((t_object *)x,
-                         "dictionary_getatom() returned an error: %d",
-                         e);
-            goto cleanup;
+            rxml_outputdict(x, root);
         }
-        if(atom_gettype(&val) != A_OBJ)
+        else
         {
-            object_error((t_object *)x,
-                         "data for the root node is not a dict");
-            goto cleanup;
+            object_error((t_object *)x, "No root!");
         }
-        node = rxml_toXML(x, &doc, 
-                          keys[0]->s_name,
-                          (t_dictionary *)atom_getobj(&val));
-        if(node)
+    }
+}
+
+// Creates (or truncates) a file, returning NULL on failure
+static t_filehandle rxml_createfile(rxml *x, t_symbol *path, uint32_t type)
+{
+    char filename[MAX_FILENAME_CHARS];
+    short vol = 0;
+    t_filehandle fh = NULL;
+    if(path_frompathname(path->s_name, &vol, filename)
+       || path_createsysfile(filename, vol, type, &fh))
+    {
+        object_error((t_object *)x, "couldn't create %s", path->s_name);
+        return NULL;
+    }
+    return fh;
+}
+
+// Writes n bytes to a file. Returns 0 on success.
+static int rxml_writefile(rxml *x, t_filehandle fh, t_symbol *path,
+                          const void *data, size_t n)
+{
+    t_ptr_size count = (t_ptr_size)n;
+    if(sysfile_write(fh, &count, data) || count != (t_ptr_size)n)
+    {
+        object_error((t_object *)x, "couldn't write %s", path->s_name);
+        return 1;
+    }
+    return 0;
+}
+
+static void rxml_writeindex(rxml *x, t_symbol *path)
+{
+    const rxml_measureindex * const idx = rxml_lockindex(x);
+    if(!idx)
+    {
+        return;
+    }
+    // a header, then the ranges of the root and each part as start,
+    // head, end, each part followed by its measure count and ranges
+    std::vector<int64_t> v;
+    v.push_back(RXML_INDEX_MAGIC);
+    v.push_back((int64_t)idx->srclen);
+    v.push_back((int64_t)idx->root.start);
+    v.push_back((int64_t)idx->root.head);
+    v.push_back((int64_t)idx->root.end);
+    v.push_back((int64_t)idx->parts.size());
+    for(size_t i = 0; i < idx->parts.size(); ++i)
+    {
+        const rxml_partrange &p = idx->parts[i];
+        v.push_back((int64_t)p.part.start);
+        v.push_back((int64_t)p.part.head);
+        v.push_back((int64_t)p.part.end);
+        v.push_back((int64_t)p.measures.size());
+        for(size_t j = 0; j < p.measures.size(); ++j)
+        {
+            v.push_back((int64_t)p.measures[j].start);
+            v.push_back((int64_t)p.measures[j].head);
+            v.push_back((int64_t)p.measures[j].end);
+        }
+    }
+    critical_exit(x->lock);
+
+    t_filehandle fh = rxml_createfile(x, path, 'TEXT');
+    if(fh)
+    {
+        rxml_writefile(x, fh, path, &v[0], v.size() * sizeof(int64_t));
+        sysfile_close(fh);
+    }
+}
+
+// Text for a prefetchindex task
+struct rxml_prefetch
+{
+    rxml *x;
+    char *buf;
+};
+
+// Indexes the text copied by prefetchindex. The index is kept only if
+// it still matches the text and the current one doesn't, so a prefetch
+// that more text overtook never replaces a valid index.
+static void rxml_prefetch_task(void *arg)
+{
+    rxml_prefetch * const p = (rxml_prefetch *)arg;
+    rxml *x = p->x;
+    rxml_measureindex *idx = rxml_buildindex(x, p->buf, strlen(p->buf));
+    free(p->buf);
+    delete p;
+    if(idx)
+    {
+        critical_enter(x->lock);
+        idx = rxml_installindex(x, idx);
+        critical_exit(x->lock);
+        delete idx;
+    }
+}
+
+// Builds the measure index of the text received so far on the worker
+// pool, behind anything a message is waiting on, so that parsemeasures
+// and writeindex find it ready
+static void rxml_prefetchindex(rxml *x)
+{
+    char *buf = rxml_copybuf(x);
+    if(!buf)
+    {
+        return;
+    }
+    rxml_prefetch *p = new (std::nothrow) rxml_prefetch;
+    if(!p)
+    {
+        object_error((t_object *)x, "Couldn't allocate memory");
+        free(buf);
+        return;
+    }
+    p->x = x;
+    p->buf = buf;
+    rxml_pool_submit(RXML_PRIORITY_PREFETCH, rxml_prefetch_task, p,
+                     x->tasks);
+}
+
+// Reads an index written by writeindex. It is checked against the
+// text when parsemeasures is used, and rebuilt if it doesn't match.
+static void rxml_readindex(rxml *x, t_symbol *path)
+{
+    char filename[MAX_PATH_CHARS];
+    short vol = 0;
+    uint32_t type = 0;
+    t_filehandle fh = NULL;
+    strncpy(filename, path->s_name, MAX_PATH_CHARS - 1);
+    filename[MAX_PATH_CHARS - 1] = 0;
+    if(locatefile_extended(filename, &vol, &type, NULL, 0)
+       || path_opensysfile(filename, vol, &fh, PATH_READ_PERM))
+    {
+        object_error((t_object *)x, "couldn't open %s", path->s_name);
+        return;
+    }
+    t_ptr_size size = 0;
+    sysfile_geteof(fh, &size);
+    std::vector<int64_t> v((size_t)size / sizeof(int64_t));
+    t_ptr_size count = (t_ptr_size)(v.size() * sizeof(int64_t));
+    const t_ptr_size want = count;
+    const bool readerr = v.empty() || sysfile_read(fh, &count, &v[0])
+        || count != want;
+    sysfile_close(fh);
+
+    rxml_measureindex *idx = new (std::nothrow) rxml_measureindex;
+    size_t i = 0;
+    bool ok = idx && !readerr && v.size() >= 6 && v[0] == RXML_INDEX_MAGIC;
+    if(ok)
+    {
+        idx->srclen = (size_t)v[1];
+        idx->root.start = (size_t)v[2];
+        idx->root.head = (size_t)v[3];
+        idx->root.end = (size_t)v[4];
+        const int64_t nparts = v[5];
+        i = 6;
+        for(int64_t p = 0; ok && p < nparts; ++p)
+        {
+            if(v.size() - i < 4)
+            {
+                ok = false;
+                break;
+            }
+            rxml_partrange part;
+            part.part.start = (size_t)v[i];
+            part.part.head = (size_t)v[i + 1];
+            part.part.end = (size_t)v[i + 2];
+            const int64_t nmeasures = v[i + 3];
+            i += 4;
+            if(nmeasures < 0 || (v.size() - i) / 3 < (size_t)nmeasures)
+            {
+                ok = false;
+                break;
+            }
+            part.measures.resize((size_t)nmeasures);
+            for(int64_t m = 0; m < nmeasures; ++m, i += 3)
+            {
+                part.measures[m].start = (size_t)v[i];
+                part.measures[m].head = (size_t)v[i + 1];
+                part.measures[m].end = (size_t)v[i + 2];
+            }
+            idx->parts.push_back(part);
+        }
+    }
+    if(!ok)
+    {
+        object_error((t_object *)x, "%s is not a measure index",
+                     path->s_name);
+        delete idx;
+        return;
+    }
+    critical_enter(x->lock);
+    std::swap(x->mindex, idx);
+    critical_exit(x->lock);
+    delete idx;
+}
+
+// Appends s as a JSON string literal
+static void rxml_jsonstring(std::string &out, const char *s, size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    out += '"';
+    const char *run = s;
+    const char * const end = s + n;
+    for(const char *p = s; p < end; ++p)
+    {
+        const unsigned char c = (unsigned char)*p;
+        if(c >= 0x20 && c != '"' && c != '\\')
+        {
+            continue;
+        }
+        out.append(run, p - run);
+        run = p + 1;
+        switch(c)
+        {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+        {
+            const char u[] = {
+                '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]
+            };
+            out.append(u, sizeof(u));
+        }
+        }
+    }
+    out.append(run, end - run);
+    out += '"';
+}
+
+static void rxml_jsonkey(std::string &out, const char *s, size_t n)
+{
+    rxml_jsonstring(out, s, n);
+    out += ':';
+}
+
+// Appends one whitespace-separated word of an attribute value, as a
+// number if atom_setparse() would make it one
+static void rxml_jsonword(std::string &out, const char *s, size_t n)
+{
+    char buf[RXML_NUMBUF_SIZE];
+    if(n && n < RXML_NUMBUF_SIZE
+       && strspn(s, "0123456789+-.eE") >= n
+       && ((s[0] >= '0' && s[0] <= '9') || s[0] == '-' || s[0] == '.'))
+    {
+        memcpy(buf, s, n);
+        buf[n] = 0;
+        char *e = NULL;
+        const long long l = strtoll(buf, &e, 10);
+        if(e == buf + n)
+        {
+            out.append(buf, rxml_formatlong((t_atom_long)l, buf));
+            return;
+        }
+        const double d = strtod(buf, &e);
+        if(e == buf + n && d - d == 0.)
+        {
+            out.append(buf, rxml_formatfloat(d, buf));
+            return;
+        }
+    }
+    rxml_jsonstring(out, s, n);
+}
+
+// Appends an attribute as "@name": value, preceded by a comma unless
+// *first is set, and skipped if the value is empty, as in the dict
+static void rxml_jsonattr(std::string &out, const xml_attribute<> *a,
+                          bool *first)
+{
+    const char *p = a->value();
+    const char * const end = p + a->value_size();
+    std::vector<std::pair<const char *, size_t> > words;
+    // bounded by end rather than a terminator: ranges aren't terminated,
+    // and a decoded &#0; is a NUL inside the value
+    while(p < end)
+    {
+        while(p < end && rxml_isspace(*p))
+        {
+            ++p;
+        }
+        const char * const word = p;
+        while(p < end && !rxml_isspace(*p))
+        {
+            ++p;
+        }
+        if(p > word)
+        {
+            words.push_back(std::make_pair(word, (size_t)(p - word)));
+        }
+    }
+    if(words.empty())
+    {
+        return;
+    }
+    if(!*first)
+    {
+        out += ',';
+    }
+    *first = false;
+    out += '"';
+    out += '@';
+    out.append(a->name(), a->name_size());
+    out += "\":";
+    if(words.size() == 1)
+    {
+        rxml_jsonword(out, words[0].first, words[0].second);
+        return;
+    }
+    out += '[';
+    for(size_t i = 0; i < words.size(); ++i)
+    {
+        if(i)
+        {
+            out += ',';
+        }
+        rxml_jsonword(out, words[i].first, words[i].second);
+    }
+    out += ']';
+}
+
+// Appends the values of the text or comment nodes of an element, one
+// value or an array of several, as rxml_appendpiece() stores them
+static void rxml_jsonpieces(rxml *x, std::string &out,
+                            const std::vector<const xml_node<> *> &pieces)
+{
+    if(pieces.size() > 1)
+    {
+        out += '[';
+    }
+    for(size_t i = 0; i < pieces.size(); ++i)
+    {
+        const xml_node<> * const n = pieces[i];
+        t_atom a;
+        if(i)
+        {
+            out += ',';
+        }
+        if(x->typed && n->type() == node_data
+           && !rxml_parsenumber(n->value(), n->value_size(), &a))
+        {
+            char buf[RXML_NUMBUF_SIZE];
+            out.append(buf, atom_gettype(&a) == A_LONG
+                       ? rxml_formatlong(atom_getlong(&a), buf)
+                       : rxml_formatfloat(atom_getfloat(&a), buf));
+        }
+        else
+        {
+            rxml_jsonstring(out, n->value(), n->value_size());
+        }
+    }
+    if(pieces.size() > 1)
+    {
+        out += ']';
+    }
+}
+
+// An element whose JSON object is being appended by rxml_jsonelement()
+struct rxml_jsonframe
+{
+    const xml_node<> *node;
+    // the first node of each key, in order of first appearance, and the
+    // text and comment nodes
+    std::vector<const xml_node<> *> groups, texts, comments;
+    size_t group;               // next group to append
+    const xml_node<> *member;   // next element of the current group
+    long k;                     // index of member in its group
+    bool first;                 // no key appended yet
+};
+
+// Appends the opening brace and attributes of an element's object, and
+// sorts its children into f
+static void rxml_jsonopen(std::string &out, const xml_node<> *node,
+                          rxml_jsonframe &f)
+{
+    f.node = node;
+    f.group = 0;
+    f.member = NULL;
+    f.k = 0;
+    f.first = true;
+    out += '{';
+    for(const xml_attribute<> *a = node->first_attribute();
+        a;
+        a = a->next_attribute())
+    {
+        rxml_jsonattr(out, a, &f.first);
+    }
+    for(const xml_node<> *n = node->first_node(); n; n = n->next_sibling())
+    {
+        switch(n->type())
+        {
+        case node_element:
+        {
+            size_t i = 0;
+            while(i < f.groups.size()
+                  && !(f.groups[i]->type() == node_element
+                       && f.groups[i]->name_size() == n->name_size()
+                       && !memcmp(f.groups[i]->name(), n->name(),
+                                  n->name_size())))
+            {
+                ++i;
+            }
+            if(i == f.groups.size())
+            {
+                f.groups.push_back(n);
+            }
+        }
+        break;
+        case node_data:
+        case node_cdata:
+            // like the dict, all text goes under one key, placed where
+            // the first text is
+            if(f.texts.empty())
+            {
+                f.groups.push_back(n);
+            }
+            f.texts.push_back(n);
+            break;
+        case node_comment:
+            if(f.comments.empty())
+            {
+                f.groups.push_back(n);
+            }
+            f.comments.push_back(n);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// Appends ".ordering", listing the child elements of node in document
+// order, and the closing brace of its object
+static void rxml_jsonclose(std::string &out, const xml_node<> *node,
+                           bool first)
+{
+    long nelements = 0;
+    for(const xml_node<> *n = node->first_node(); n; n = n->next_sibling())
+    {
+        nelements += n->type() == node_element;
+    }
+    if(nelements)
+    {
+        if(!first)
+        {
+            out += ',';
+        }
+        rxml_jsonkey(out, ps_ordering->s_name, strlen(ps_ordering->s_name));
+        if(nelements > 1)
+        {
+            out += '[';
+        }
+        first = true;
+        for(const xml_node<> *n = node->first_node();
+            n;
+            n = n->next_sibling())
+        {
+            if(n->type() == node_element)
+            {
+                if(!first)
+                {
+                    out += ',';
+                }
+                first = false;
+                rxml_jsonstring(out, n->name(), n->name_size());
+            }
+        }
+        if(nelements > 1)
+        {
+            out += ']';
+        }
+    }
+    out += '}';
+}
+
+// Appends the JSON object for an element, in the shape that
+// rxml_toJSON() gives the dict: "@" attributes, then children grouped
+// by name under "0", "1", ... in order of first appearance, ".text",
+// and ".ordering" listing the child elements in document order. The
+// elements being appended are kept on a stack of their own rather
+// than the call stack, however deep the document.
+static void rxml_jsonelement(rxml *x, std::string &out,
+                             const xml_node<> *node)
+{
+    std::vector<rxml_jsonframe> stack(1);
+    rxml_jsonopen(out, node, stack.back());
+    while(!stack.empty())
+    {
+        rxml_jsonframe &f = stack.back();
+        if(f.member)
+        {
+            // the next element of a group
+            const xml_node<> * const n = f.member;
+            const xml_node<> * const g = f.groups[f.group - 1];
+            char key[RXML_NUMBUF_SIZE];
+            if(f.k)
+            {
+                out += ',';
+            }
+            rxml_jsonkey(out, key, rxml_formatlong(f.k++, key));
+            f.member = n->next_sibling(g->name(), g->name_size());
+            stack.push_back(rxml_jsonframe());
+            rxml_jsonopen(out, n, stack.back());
+            continue;
+        }
+        if(f.k)
+        {
+            // the end of a group
+            out += '}';
+            f.k = 0;
+        }
+        if(f.group == f.groups.size())
+        {
+            rxml_jsonclose(out, f.node, f.first);
+            stack.pop_back();
+            continue;
+        }
+        const xml_node<> * const g = f.groups[f.group++];
+        if(!f.first)
+        {
+            out += ',';
+        }
+        f.first = false;
+        if(g->type() == node_comment)
+        {
+            rxml_jsonkey(out, ps_comment->s_name, strlen(ps_comment->s_name));
+            rxml_jsonpieces(x, out, f.comments);
+        }
+        else if(g->type() != node_element)
+        {
+            rxml_jsonkey(out, ps_text->s_name, strlen(ps_text->s_name));
+            rxml_jsonpieces(x, out, f.texts);
+        }
+        else
+        {
+            rxml_jsonkey(out, g->name(), g->name_size());
+            out += '{';
+            f.member = g;
+        }
+    }
+}
+
+// Serializes the document to JSON text with the same shape as the dict
+// output by bang, without building any dictionaries. Returns 0 on
+// success.
+static int rxml_toJSONText(rxml *x, const xml_document<> *doc,
+                           std::string &out)
+{
+    const xml_node<> *root = rxml_rootelement(doc->first_node());
+    if(!root)
+    {
+        object_error((t_object *)x, "No root!");
+        return 1;
+    }
+    out += '{';
+    rxml_jsonkey(out, root->name(), root->name_size());
+    rxml_jsonelement(x, out, root);
+    out += '}';
+    return 0;
+}
+
+// Parses the accumulated text into out as JSON. Returns 0 on success.
+static int rxml_jsonbuf(rxml *x, std::string &out)
+{
+    size_t len = 0;
+    char *buf = rxml_takebuf(x, &len);
+    if(!buf)
+    {
+        return 1;
+    }
+    int err = 1;
+    {
+        xml_document<> doc;
+        if(!rxml_parse(x, &doc, buf))
+        {
+            rxml_orient(x, &doc);
+            // the JSON is usually about twice as long as the XML
+            out.reserve(len * 2);
+            err = rxml_toJSONText(x, &doc, out);
+        }
+    }
+    free(buf);
+    return err;
+}
+
+// Outputs the accumulated text as JSON in a string in a dict, as
+// "json <dictname>", for node.script and other JSON consumers
+static void rxml_json(rxml *x)
+{
+    std::string out;
+    if(!rxml_jsonbuf(x, out))
+    {
+        rxml_outputString(x, &x->jsondict, &x->jsondictname, ps_json, out);
+    }
+}
+
+// Writes the accumulated text as JSON to a file, then outputs
+// "writejson <path>"
+static void rxml_writejson(rxml *x, t_symbol *path)
+{
+    std::string out;
+    if(rxml_jsonbuf(x, out))
+    {
+        return;
+    }
+    t_filehandle fh = rxml_createfile(x, path, 'TEXT');
+    if(!fh)
+    {
+        return;
+    }
+    const int err = rxml_writefile(x, fh, path, out.data(), out.size());
+    sysfile_close(fh);
+    if(err)
+    {
+        return;
+    }
+    t_atom a;
+    atom_setsym(&a, path);
+    outlet_anything(x->outlets[RXML_OUTLET_MAIN], ps_writejson, 1, &a);
+}
+
+// Reads the <beats> of a time signature, adding up the terms of a
+// composite one, so that "3+2" gives 5
+static long rxml_timebeats(const char *s)
+{
+    long beats = 0;
+    for(char *e = (char *)s; *s; s = e + (*e == '+'))
+    {
+        beats += strtol(s, &e, 10);
+        if(e == s)
         {
-        	doc.append_node(node);
+            break;
         }
-        rxml_outputXML(x, &doc);
-        if(keys)
+    }
+    return beats;
+}
+
+// Finds the <score-part> for a part's id attribute in the <part-list>
+static const xml_node<> *rxml_scorepart(const xml_node<> *root,
+                                        const xml_attribute<> *id)
+{
+    const xml_node<> * const list = root->first_node("part-list");
+    for(const xml_node<> *n = list ? list->first_node("score-part") : NULL;
+        n;
+        n = n->next_sibling("score-part"))
+    {
+        const xml_attribute<> * const a = n->first_attribute("id");
+        if(a && a->value_size() == id->value_size()
+           && !memcmp(a->value(), id->value(), id->value_size()))
         {
-            sysmem_freeptr(keys);
+            return n;
         }
     }
-    
-cleanup:
-    dictobj_release(d);
-    doc.clear();
+    return NULL;
 }
 
-static void rxml_toJSON(rxml *x, const xml_node<> *node,
-                        t_dictionary *d)
+static void rxml_midi_add(std::vector<rxml_midievent> &track, long tick,
+                          int order, const unsigned char *bytes,
+                          size_t n)
 {
-    assert(node);
-    assert(d);
-    const node_type t = node->type();
-    switch(t)
+    rxml_midievent e;
+    e.tick = tick;
+    e.order = order;
+    e.nbytes = (unsigned char)n;
+    memcpy(e.bytes, bytes, n);
+    track.push_back(e);
+}
+
+static void rxml_midi_tempo(std::vector<rxml_midievent> &track,
+                            long tick, double bpm)
+{
+    const unsigned long usec = (unsigned long)(60000000. / bpm + .5);
+    const unsigned char b[] = {
+        0xff, 0x51, 0x03, (unsigned char)(usec >> 16),
+        (unsigned char)(usec >> 8), (unsigned char)usec
+    };
+    rxml_midi_add(track, tick, 0, b, sizeof(b));
+}
+
+static void rxml_midi_timesig(std::vector<rxml_midievent> &track,
+                              long tick, long beats, long beattype)
+{
+    unsigned char log2 = 0;
+    while((1L << (log2 + 1)) <= beattype)
     {
-    case node_element:
+        ++log2;
+    }
+    const unsigned char b[] = {
+        0xff, 0x58, 0x04, (unsigned char)beats, log2, 24, 8
+    };
+    rxml_midi_add(track, tick, 0, b, sizeof(b));
+}
+
+static void rxml_midi_vlq(std::vector<unsigned char> &out, unsigned long v)
+{
+    unsigned char tmp[5];
+    size_t n = 0;
+    tmp[n++] = v & 0x7f;
+    while(v >>= 7)
     {
-        t_dictionary *thiselem = dictionary_new();
-        t_symbol *thiselem_name = gensym(node->name());
-        if(dictionary_hasentry(d, thiselem_name))
+        tmp[n++] = 0x80 | (v & 0x7f);
+    }
+    while(n)
+    {
+        out.push_back(tmp[--n]);
+    }
+}
+
+// Sorts the events and appends them to out as an MTrk chunk, preceded
+// by a track name if there is one
+static void rxml_midi_track(std::vector<unsigned char> &out,
+                            std::vector<rxml_midievent> &track,
+                            const char *name)
+{
+    std::stable_sort(track.begin(), track.end(), rxml_midievent_before);
+    const unsigned char head[] = { 'M', 'T', 'r', 'k', 0, 0, 0, 0 };
+    out.insert(out.end(), head, head + sizeof(head));
+    const size_t start = out.size();
+    if(name && *name)
+    {
+        const size_t n = strlen(name);
+        out.push_back(0);
+        out.push_back(0xff);
+        out.push_back(0x03);
+        rxml_midi_vlq(out, n);
+        out.insert(out.end(), name, name + n);
+    }
+    long last = 0;
+    for(size_t i = 0; i < track.size(); ++i)
+    {
+        rxml_midi_vlq(out, track[i].tick - last);
+        last = track[i].tick;
+        out.insert(out.end(), track[i].bytes,
+                   track[i].bytes + track[i].nbytes);
+    }
+    const unsigned char eot[] = { 0, 0xff, 0x2f, 0 };
+    out.insert(out.end(), eot, eot + sizeof(eot));
+    const size_t len = out.size() - start;
+    out[start - 4] = (unsigned char)(len >> 24);
+    out[start - 3] = (unsigned char)(len >> 16);
+    out[start - 2] = (unsigned char)(len >> 8);
+    out[start - 1] = (unsigned char)len;
+}
+
+// Builds the track for a <part>, on the given channel. Tied notes are
+// joined, rests, grace and cue notes are skipped, and velocities come
+// from the dynamics attribute of <note> (a percentage of forte, 90). If
+// conductor is not NULL, tempo and time signature changes are added to
+// it.
+static void rxml_midi_part(const xml_node<> *root, const xml_node<> *part,
+                           unsigned char channel,
+                           std::vector<rxml_midievent> &track,
+                           std::vector<rxml_midievent> *conductor)
+{
+    const xml_attribute<> * const id = part->first_attribute("id");
+    const xml_node<> * const sp = id ? rxml_scorepart(root, id)
+                                     : NULL;
+    const xml_node<> * const inst = sp ? sp->first_node("midi-instrument")
+                                       : NULL;
+    const char * const program = inst ? rxml_childtext(inst, "midi-program")
+                                      : NULL;
+    if(program && atol(program) >= 1 && atol(program) <= 128)
+    {
+        const unsigned char b[] = {
+            (unsigned char)(0xc0 | channel),
+            (unsigned char)(atol(program) - 1)
+        };
+        rxml_midi_add(track, 0, 2, b, sizeof(b));
+    }
+    // note off events of notes that are tied to a later one, by pitch
+    std::map<int, size_t> tied;
+    rxml_cursor c;
+    rxml_cursor_init(&c);
+    rxml_cursor_part(&c);
+    for(const xml_node<> *meas = part->first_node("measure");
+        meas;
+        meas = meas->next_sibling("measure"))
+    {
+        rxml_cursor_measure(&c);
+        for(const xml_node<> *n = meas->first_node();
+            n;
+            n = n->next_sibling())
         {
-            t_dictionary *parent = NULL;
-            t_max_err e = dictionary_getdictionary(d, thiselem_name,
-                                                   (t_object **)&parent);
-            if(e)
+            if(n->type() != node_element)
             {
-                object_error((t_object *)x,
-                             "Error converting to JSON");
-                return;
+                continue;
             }
-            long nkeys = dictionary_getentrycount(parent);
-            char k[32];
-            snprintf(k, 32, "%ld", nkeys);
-            dictionary_appenddictionary(parent, gensym(k),
-                                        (t_object *)thiselem);
-        }
-        else
-        {
-            t_dictionary *dd = dictionary_new();
-            dictionary_appenddictionary(d, thiselem_name,
-                                        (t_object *)dd);
-            dictionary_appenddictionary(dd, ps_0,
-                                        (t_object *)thiselem);
-        }
-        
-        for(const xml_attribute<> *a = node->first_attribute();
-            a;
-            a = a->next_attribute())
-        {
-            size_t n = strlen(a->name());
-            // char key[n + 2];
-            char* key = (char*)alloca(n + 2);
-            snprintf(key, n + 2, "@%s", a->name());
-            {
-                t_atom *vals = NULL;
-                long nvals = 0;
-                t_max_err e = atom_setparse(&nvals, &vals, a->value());
-                if(e)
-                {
-                    object_error((t_object *)x,
-                                 "encountered an error parsing string "
-                                 "to atom array");
-                    return;
-                }
-                if(vals && nvals)
+            const double pos = c.pos;
+            double dur = 0.;
+            const double onset = rxml_cursor_advance(&c, n, &dur);
+            // cue notes take up time, but are not played
+            const double pitch = onset >= 0. && !n->first_node("cue")
+                ? rxml_midipitch(n) : 0.;
+            if(pitch > 0. && pitch < 128. && dur > 0.)
+            {
+                const int key = (int)(pitch + .5);
+                const long on = (long)(onset * RXML_MIDI_PPQ + .5);
+                const long off = (long)((onset + dur) * RXML_MIDI_PPQ + .5);
+                const long tie = rxml_notetie(n);
+                std::map<int, size_t>::iterator t = tied.find(key);
+                if((tie & 2) && t != tied.end())
                 {
-                    if(nvals == 1)
-                    {
-                        dictionary_appendatom(thiselem,
-                                              gensym(key),
-                                              vals);
-                    }
-                    else
+                    track[t->second].tick = off;
+                    if(!(tie & 1))
                     {
-                        dictionary_appendatoms(thiselem, gensym(key),
-                                               nvals, vals);
+                        tied.erase(t);
                     }
-                    sysmem_freeptr(vals);
+                    continue;
+                }
+                const xml_attribute<> * const dyn =
+                    n->first_attribute("dynamics");
+                long vel = dyn ? (long)(atof(dyn->value()) * .9 + .5)
+                               : RXML_MIDI_VELOCITY;
+                vel = vel < 1 ? 1 : (vel > 127 ? 127 : vel);
+                const unsigned char b[] = {
+                    (unsigned char)(0x90 | channel), (unsigned char)key,
+                    (unsigned char)vel
+                };
+                rxml_midi_add(track, on, 2, b, sizeof(b));
+                const unsigned char e[] = {
+                    (unsigned char)(0x80 | channel), (unsigned char)key, 0
+                };
+                rxml_midi_add(track, off, 1, e, sizeof(e));
+                if(tie & 1)
+                {
+                    tied[key] = track.size() - 1;
                 }
             }
-        }
-
-        long i = 0;
-        for(const xml_node<> *n = node->first_node();
-            n;
-            n = n->next_sibling())
-        {
-            if(n->type() == node_element)
-            {
-                ++i;
-            }
-        }
-
-        {
-            // t_atom ordering[i];
-            t_atom* ordering = (t_atom *)alloca(i * sizeof(t_atom));
-            i = 0;
-            for(const xml_node<> *n = node->first_node();
-                n;
-                n = n->next_sibling())
+            else if(conductor && rxml_isnamed(n, "attributes"))
             {
-                if(n->type() == node_element)
+                const xml_node<> * const time = n->first_node("time");
+                const char * const beats =
+                    time ? rxml_childtext(time, "beats") : NULL;
+                const char * const beattype =
+                    time ? rxml_childtext(time, "beat-type") : NULL;
+                if(beats && beattype)
                 {
-                    atom_setsym(ordering + i, gensym(n->name()));
-                    ++i;
+                    rxml_midi_timesig(*conductor,
+                                      (long)(pos * RXML_MIDI_PPQ + .5),
+                                      rxml_timebeats(beats), atol(beattype));
                 }
-                rxml_toJSON(x, n, thiselem);
             }
-            if(i)
+            else if(conductor && (rxml_isnamed(n, "direction")
+                                  || rxml_isnamed(n, "sound")))
             {
-                dictionary_appendatoms(thiselem, ps_ordering,
-                                       i, ordering);
+                const xml_node<> * const sound = rxml_isnamed(n, "sound")
+                    ? n : n->first_node("sound");
+                const xml_attribute<> * const tempo =
+                    sound ? sound->first_attribute("tempo") : NULL;
+                if(tempo && atof(tempo->value()) > 0.)
+                {
+                    rxml_midi_tempo(*conductor,
+                                    (long)(pos * RXML_MIDI_PPQ + .5),
+                                    atof(tempo->value()));
+                }
             }
         }
     }
-    break;
-    case node_data:
-    {
-        dictionary_appendsym(d,
-                             ps_text,
-                             gensym(node->value()));
-    }
-    break;
-    default:
-        object_error((t_object *)x,
-                     "Encountered unexpected node type: %d",
-                     t);
-        return;
-    }
 }
 
-static void rxml_bang(rxml *x)
+// Writes the accumulated MusicXML as a type 1 Standard MIDI File: a
+// conductor track with the tempo and time signatures of the first
+// part, then one track per <part>, each on its own channel (skipping
+// channel 10, the drum channel, and starting over after 15 parts), and
+// outputs "writemidi <path>". Each track is written as soon as it is
+// built.
+static void rxml_writemidi(rxml *x, t_symbol *path)
 {
-    critical_enter(x->lock);
-    size_t bufpos = x->bufpos;
-    critical_exit(x->lock);
-    if(!bufpos)
+    size_t len = 0;
+    char *buf = rxml_takebuf(x, &len);
+    if(!buf)
     {
-        object_error((t_object *)x, "no text to process");
         return;
     }
-    char *buf = (char *)malloc(bufpos + 1);
-    if(!buf)
+    xml_document<> *doc = new (std::nothrow) xml_document<>;
+    if(!doc)
     {
-        object_error((t_object *)x,
-                     "Couldn't allocate memory for temporary buffer");
+        object_error((t_object *)x, "Couldn't allocate document");
+        free(buf);
         return;
     }
-    critical_enter(x->lock);
-    memcpy(buf, x->buf, bufpos + 1);
-    critical_exit(x->lock);
-    buf[bufpos] = 0;
-    
-    xml_document<> doc;
-
-    // RAPIDXML_NO_EXCEPTIONS is defined in the Xcode project when
-    // building in debug mode, which will cause an assertion to
-    // fire in the case of an error.
-#ifndef RAPIDXML_NO_EXCEPTIONS
-    try{
-        doc.parse<0>(buf);
+    xml_node<> *root = NULL;
+    if(!rxml_parse(x, doc, buf))
+    {
+        root = rxml_rootelement(doc->first_node());
+        if(root && rxml_isnamed(root, "score-timewise"))
+        {
+            rxml_topartwise(doc, root);
+        }
+        if(!root || !rxml_isnamed(root, "score-partwise"))
+        {
+            object_error((t_object *)x, "writemidi: not a MusicXML score");
+            root = NULL;
+        }
     }
-    catch (const std::runtime_error& e)
+    t_filehandle fh = root ? rxml_createfile(x, path, 'Midi') : NULL;
+    if(fh)
     {
-        //std::cerr << "Runtime error was: " << e.what() << std::endl;
-        object_error((t_object *)x, "Runtime error: %s", e.what());
-        clearbuf(x);
-        return;
+        std::vector<const xml_node<> *> parts;
+        for(const xml_node<> *p = root->first_node("part");
+            p;
+            p = p->next_sibling("part"))
+        {
+            parts.push_back(p);
+        }
+        const long ntracks = (long)parts.size() + 1;
+        const unsigned char head[] = {
+            'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1,
+            (unsigned char)(ntracks >> 8), (unsigned char)ntracks,
+            (unsigned char)(RXML_MIDI_PPQ >> 8),
+            (unsigned char)(RXML_MIDI_PPQ & 0xff)
+        };
+        std::vector<unsigned char> out(head, head + sizeof(head));
+        std::vector<rxml_midievent> conductor, track;
+        int err = 0;
+        for(size_t i = 0; i < parts.size() && !err; ++i)
+        {
+            // the 15 channels other than 10 (9 counting from 0), in turn
+            const unsigned char channel =
+                (unsigned char)(i % 15 + (i % 15 >= 9));
+            track.clear();
+            rxml_midi_part(root, parts[i], channel, track,
+                           i ? NULL : &conductor);
+            if(!i)
+            {
+                const xml_node<> * const work = root->first_node("work");
+                const char *title = work ? rxml_childtext(work, "work-title")
+                                         : NULL;
+                rxml_midi_track(out, conductor, title ? title
+                                : rxml_childtext(root, "movement-title"));
+            }
+            const xml_attribute<> * const id = parts[i]->first_attribute("id");
+            const xml_node<> * const sp =
+                id ? rxml_scorepart(root, id) : NULL;
+            rxml_midi_track(out, track,
+                            sp ? rxml_childtext(sp, "part-name") : NULL);
+            err = rxml_writefile(x, fh, path, &out[0], out.size());
+            out.clear();
+        }
+        if(parts.empty())
+        {
+            rxml_midi_track(out, conductor, NULL);
+            err = rxml_writefile(x, fh, path, &out[0], out.size());
+        }
+        sysfile_close(fh);
+        if(!err)
+        {
+            t_atom a;
+            atom_setsym(&a, path);
+            outlet_anything(x->outlets[RXML_OUTLET_MAIN], ps_writemidi,
+                            1, &a);
+        }
     }
-    catch (const rapidxml::parse_error& e)
+    delete doc;
+    free(buf);
+}
+
+// Outputs only the note table for the accumulated text, and the time
+// index if @timeindex is on, without converting it to a dict. Sent as
+// the notetable message, as notes is the attribute turning the table on
+static void rxml_notes(rxml *x)
+{
+    size_t len = 0;
+    char *buf = rxml_takebuf(x, &len);
+    if(!buf)
     {
-        object_error((t_object *)x, "Parse error: %s", e.what());
-        //std::cerr << "Parse error was: " << e.what() << std::endl;
-        clearbuf(x);
         return;
     }
-    catch (const std::exception& e)
+    xml_document<> *doc = new (std::nothrow) xml_document<>;
+    if(!doc)
     {
-        object_error((t_object *)x, "Error: %s", e.what());
-        //std::cerr << "Error was: " << e.what() << std::endl;
-        clearbuf(x);
+        object_error((t_object *)x, "Couldn't allocate document");
+        free(buf);
         return;
     }
-    catch (...)
+    if(!rxml_parse(x, doc, buf))
     {
-        object_error((t_object *)x, "Unknown error");
-        // std::cerr << "An unknown error occurred." << std::endl;
-        clearbuf(x);
-        return;
+        const xml_node<> *root = rxml_rootelement(doc->first_node());
+        if(root)
+        {
+            rxml_notetable table;
+            rxml_cursor_init(&(table.cursor));
+            rxml_notes_walk(&table, root);
+            rxml_outputnotes(x, &table);
+            if(x->timeindex)
+            {
+                rxml_outputtimes(x, &table);
+            }
+        }
+        else
+        {
+            object_error((t_object *)x, "No root!");
+        }
     }
-#else
-    doc.parse<0>(buf);
-#endif
-    
-    xml_node<> *root = doc.first_node();
-    if(!root)
+    delete doc;
+    free(buf);
+}
+
+// Sets the parse flags from a list of names. Any combination of
+// noentity (no entity translation), trim, normalize (whitespace) and
+// comments may be given; fastest is the same as noentity, and default
+// (or no names) selects the standard parse.
+static t_max_err rxml_parseflags_set(rxml *x, void *attr,
+                                     long ac, t_atom *av)
+{
+    long flags = 0;
+    if(ac > RXML_MAX_PARSEFLAGS)
     {
-        object_error((t_object *)x, "No root!");
-        goto cleanup;
+        ac = RXML_MAX_PARSEFLAGS;
     }
-    else
+    for(long i = 0; i < ac; ++i)
     {
-        t_dictionary *rd = dictionary_new();
-        rxml_toJSON(x, root, rd);
+        const char * const name = atom_getsym(av + i)->s_name;
+        if(!strcmp(name, "noentity") || !strcmp(name, "fastest"))
         {
-			// the root node is special--the file cannot contain
-            // multiple copies of it, so it shouldn't have an index
-            t_dictionary *d = NULL;
-            t_max_err e = dictionary_getdictionary(rd,
-                                                   gensym(root->name()),
-                                                   (t_object **)&d);
-            if(e)
-            {
-                object_error((t_object *)x,
-                             "error converting to dict: "
-                             "no root node was created (%d)",
-                             e);
-                goto cleanup;
-            }
-            t_dictionary *dd = NULL;
-            e = dictionary_getdictionary(d,
-                                         ps_0,
-                                         (t_object **)&dd);
-            if(e)
-            {
-                object_error((t_object *)x,
-                             "error converting to dict (%d)",
-                             e);
-                goto cleanup;
-            }
-            dictionary_chuckentry(rd, gensym(root->name()));
-            dictionary_chuckentry(d, ps_0);
-            object_free((t_object *)d);
-            dictionary_appenddictionary(rd,
-                                        gensym(root->name()),
-                                        (t_object *)dd);
+            flags |= 1;
         }
-        t_symbol *name = NULL;
-        t_dictionary *dd = dictobj_register(rd, &name);
-        if(!dd || !name)
+        else if(!strcmp(name, "trim"))
         {
-            object_error((t_object *)x, "Couldn't register dict");
-            goto cleanup;
+            flags |= 2;
+        }
+        else if(!strcmp(name, "normalize"))
+        {
+            flags |= 4;
+        }
+        else if(!strcmp(name, "comments"))
+        {
+            flags |= 8;
+        }
+        else if(strcmp(name, "default"))
+        {
+            object_error((t_object *)x, "unknown parse flag %s", name);
+            return MAX_ERR_GENERIC;
         }
-        t_atom out;
-        atom_setsym(&out, name);
-        outlet_anything(x->outlets[RXML_OUTLET_MAIN],
-                        ps_dictionary, 1, &out);
-        dictobj_release(dd);
     }
-cleanup:
-    if(buf)
+    x->parseflags = flags;
+    for(long i = 0; i < ac; ++i)
     {
-        free(buf);
+        x->parseflagsyms[i] = atom_getsym(av + i);
     }
-    critical_enter(x->lock);
-    memset(x->buf, 0, x->bufpos);
-    x->bufpos = 0;
-    doc.clear();
-    critical_exit(x->lock);
+    x->nparseflagsyms = ac;
+    return MAX_ERR_NONE;
+}
+
+// Outputs "allocstats <blocks> <bytes> <peak> <allocated> <padding>"
+// for the last document parsed: the blocks its pool took beyond the
+// RAPIDXML_STATIC_POOL_SIZE bytes inside the document, their total
+// size, the most bytes held in blocks at once by this instance's
+// documents, the bytes allocated from the pool, and the bytes lost to
+// alignment. When blocks is 0 the document fitted in the static pool.
+static void rxml_allocstats(rxml *x)
+{
+    t_atom out[5];
+    atom_setlong(out, (t_atom_long)x->arena->blocks());
+    atom_setlong(out + 1, (t_atom_long)x->arena->bytes());
+    atom_setlong(out + 2, (t_atom_long)x->arena->peak());
+    atom_setlong(out + 3, (t_atom_long)x->arena->allocated());
+    atom_setlong(out + 4, (t_atom_long)x->arena->padding());
+    outlet_anything(x->outlets[RXML_OUTLET_MAIN], ps_allocstats, 5, out);
 }
 
 static void rxml_clear(rxml *x)
@@ -714,20 +5738,65 @@ static void rxml_clear(rxml *x)
 static void clearbuf(rxml *x)
 {
     assert(x);
+    critical_enter(x->lock);
+    rxml_ingest_read(x->ingest, rxml_drain_discard, NULL);
     if(x->buf)
     {
         memset(x->buf, 0, x->buflen);
     }
     x->bufpos = 0;
+    critical_exit(x->lock);
 }
 
 static void rxml_free(rxml *x)
 {
+    if(x->tasks)
+    {
+        rxml_taskgroup_wait(x->tasks);
+        delete x->tasks;
+    }
+    rxml_slice_cancel(x);
+    if(x->sliceq)
+    {
+        qelem_free(x->sliceq);
+    }
+    free(x->slicebuf);
     critical_free(x->lock);
+    critical_free(x->writelock);
+    if(x->ingest)
+    {
+        rxml_ingest_free(x->ingest);
+    }
     if(x->buf)
     {
         free(x->buf);
     }
+    delete x->diffdoc;
+    free(x->diffbuf);
+    if(x->xmldict)
+    {
+        object_free((t_object *)x->xmldict);
+    }
+    if(x->diffdict)
+    {
+        object_free((t_object *)x->diffdict);
+    }
+    if(x->notesdict)
+    {
+        object_free((t_object *)x->notesdict);
+    }
+    if(x->timesdict)
+    {
+        object_free((t_object *)x->timesdict);
+    }
+    if(x->jsondict)
+    {
+        object_free((t_object *)x->jsondict);
+    }
+    delete x->times;
+    delete x->mindex;
+    // after every document, whose blocks it counts
+    delete x->arena;
 }
 
 static void rxml_assist(rxml *x, void *b, long m, long a, char *s)
@@ -747,6 +5816,9 @@ static void rxml_assist(rxml *x, void *b, long m, long a, char *s)
         {
 		case 0:
             snprintf(s, 32, "Outlet");
+            break;
+		case 1:
+            snprintf(s, 32, "Conversion Progress (%%)");
             break;
 		}
 	}
@@ -760,15 +5832,56 @@ static void *rxml_new(t_symbol *sym, long ac, t_atom *av)
         return NULL;
     }
     critical_new(&(x->lock));
+    critical_new(&(x->writelock));
+    x->tasks = new rxml_taskgroup;
+    x->arena = new tracked_arena;
+    x->ingest = rxml_ingest_new();
+    if(!x->ingest)
+    {
+        object_error((t_object *)x, "Couldn't allocate memory");
+        return NULL;
+    }
+    // outlets are created from right to left
+    x->outlets[RXML_OUTLET_PROGRESS] = outlet_new((t_object *)x, "float");
     x->outlets[RXML_OUTLET_MAIN] = outlet_new((t_object *)x, NULL);
-    x->buf = (char *)calloc(1000000, 1);
+    x->buf = (char *)calloc(RXML_BUFSIZE, 1);
     if(!x->buf)
     {
         object_error((t_object *)x, "Couldn't allocate memory");
         return NULL;
     }
-    x->buflen = 1000000;
+    x->buflen = RXML_BUFSIZE;
     x->bufpos = 0;
+    x->diffdoc = NULL;
+    x->diffbuf = NULL;
+    x->output = ps_lines;
+    x->typed = 0;
+    x->notes = 0;
+    x->notetable = NULL;
+    x->notesdict = NULL;
+    x->notesdictname = NULL;
+    x->timeindex = 0;
+    x->compact = 0;
+    x->stream = 0;
+    x->threads = 1;
+    x->slice = 0;
+    x->sliceq = qelem_new(x, (method)rxml_slice_run);
+    x->slicejob = NULL;
+    x->slicebuf = NULL;
+    x->times = NULL;
+    x->timesdict = NULL;
+    x->timesdictname = NULL;
+    x->mindex = NULL;
+    x->orientation = ps_asis;
+    x->jsondict = NULL;
+    x->jsondictname = NULL;
+    x->parseflags = 0;
+    x->nparseflagsyms = 0;
+    x->xmldict = NULL;
+    x->xmldictname = NULL;
+    x->diffdict = NULL;
+    x->diffdictname = NULL;
+    attr_args_process(x, (short)ac, av);
 	return x;
 }
 
@@ -784,14 +5897,103 @@ void ext_main(void *r)
     class_addmethod(c, (method)rxml_bang, "bang", 0);
     class_addmethod(c, (method)rxml_clear, "clear", 0);
     class_addmethod(c, (method)rxml_dictionary, "dictionary", A_SYM, 0);
+    class_addmethod(c, (method)rxml_diff, "diff", 0);
+    class_addmethod(c, (method)rxml_notes, "notetable", 0);
+    class_addmethod(c, (method)rxml_locate, "locate", A_FLOAT, 0);
+    class_addmethod(c, (method)rxml_bar, "bar", A_LONG, 0);
+    class_addmethod(c, (method)rxml_json, "json", 0);
+    class_addmethod(c, (method)rxml_writemidi, "writemidi", A_SYM, 0);
+    class_addmethod(c, (method)rxml_writejson, "writejson", A_SYM, 0);
+    class_addmethod(c, (method)rxml_parsemeasures, "parsemeasures",
+                    A_LONG, A_LONG, A_LONG, 0);
+    class_addmethod(c, (method)rxml_writeindex, "writeindex", A_SYM, 0);
+    class_addmethod(c, (method)rxml_readindex, "readindex", A_SYM, 0);
+    class_addmethod(c, (method)rxml_prefetchindex, "prefetchindex", 0);
+    class_addmethod(c, (method)rxml_allocstats, "allocstats", 0);
 	class_addmethod(c, (method)rxml_assist,	"assist", A_CANT, 0);
 
+    CLASS_ATTR_SYM(c, "output", 0, rxml, output);
+    CLASS_ATTR_ENUM(c, "output", 0, "lines string");
+    CLASS_ATTR_LABEL(c, "output", 0, "XML Output Mode");
+
+    CLASS_ATTR_SYM(c, "orientation", 0, rxml, orientation);
+    CLASS_ATTR_ENUM(c, "orientation", 0, "asis partwise timewise");
+    CLASS_ATTR_LABEL(c, "orientation", 0, "Score Orientation");
+
+    CLASS_ATTR_CHAR(c, "typed", 0, rxml, typed);
+    CLASS_ATTR_STYLE_LABEL(c, "typed", 0, "onoff", "Typed Numeric Text");
+
+    CLASS_ATTR_CHAR(c, "notes", 0, rxml, notes);
+    CLASS_ATTR_STYLE_LABEL(c, "notes", 0, "onoff", "Output Note Table");
+
+    CLASS_ATTR_CHAR(c, "timeindex", 0, rxml, timeindex);
+    CLASS_ATTR_STYLE_LABEL(c, "timeindex", 0, "onoff", "Keep Time Index");
+
+    CLASS_ATTR_CHAR(c, "compact", 0, rxml, compact);
+    CLASS_ATTR_STYLE_LABEL(c, "compact", 0, "onoff", "Compact Document");
+
+    CLASS_ATTR_CHAR(c, "stream", 0, rxml, stream);
+    CLASS_ATTR_STYLE_LABEL(c, "stream", 0, "onoff", "Streaming Export");
+
+    CLASS_ATTR_LONG(c, "threads", 0, rxml, threads);
+    CLASS_ATTR_FILTER_MIN(c, "threads", 0);
+    CLASS_ATTR_LABEL(c, "threads", 0, "Export Threads");
+
+    CLASS_ATTR_DOUBLE(c, "slice", 0, rxml, slice);
+    CLASS_ATTR_FILTER_MIN(c, "slice", 0);
+    CLASS_ATTR_LABEL(c, "slice", 0, "Conversion Slice (ms)");
+
+    CLASS_ATTR_SYM_VARSIZE(c, "parseflags", 0, rxml, parseflagsyms,
+                           nparseflagsyms, RXML_MAX_PARSEFLAGS);
+    CLASS_ATTR_ACCESSORS(c, "parseflags", (method)NULL,
+                         (method)rxml_parseflags_set);
+    CLASS_ATTR_LABEL(c, "parseflags", 0, "Parse Flags");
+
 	class_register(CLASS_BOX, c);
 	rxml_class = c;
     ps_dictionary = gensym("dictionary");
     ps_0 = gensym("0");
     ps_ordering = gensym(".ordering");
     ps_text = gensym(".text");
+    ps_comment = gensym(".comment");
+    ps_lines = gensym("lines");
+    ps_string = gensym("string");
+    ps_xml = gensym("xml");
+    ps_json = gensym("json");
+    ps_writejson = gensym("writejson");
+    ps_writemidi = gensym("writemidi");
+    ps_notes = gensym("notes");
+    ps_part = gensym("part");
+    ps_measure = gensym("measure");
+    ps_voice = gensym("voice");
+    ps_step = gensym("step");
+    ps_alter = gensym("alter");
+    ps_octave = gensym("octave");
+    ps_duration = gensym("duration");
+    ps_tie = gensym("tie");
+    ps_onset = gensym("onset");
+    ps_asis = gensym("asis");
+    ps_partwise = gensym("partwise");
+    ps_timewise = gensym("timewise");
+    ps_timeindex = gensym("timeindex");
+    ps_note = gensym("note");
+    ps_measures = gensym("measures");
+    ps_locate = gensym("locate");
+    ps_bar = gensym("bar");
+    ps_diff = gensym("diff");
+    ps_insert = gensym("insert");
+    ps_remove = gensym("remove");
+    ps_value = gensym("value");
+    ps_attr = gensym("attr");
+    ps_removeattr = gensym("removeattr");
+    ps_done = gensym("done");
+    ps_allocstats = gensym("allocstats");
+    rxml_names_init();
+
+    // one worker per core, stopped when Max quits
+    const unsigned ncores = std::thread::hardware_concurrency();
+    rxml_workers = rxml_pool_new(ncores ? (long)ncores : 1);
+    quittask_install((method)rxml_pool_free, NULL);
 }
 
 } // extern "C"
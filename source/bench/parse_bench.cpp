@@ -0,0 +1,148 @@
+/*
+  Headless benchmark for the parse flags selectable with @parseflags.
+
+  Times rapidxml parsing of a MusicXML file (or a synthetic indented
+  score if none is given) with each flag combination the object
+  instantiates, then reports the memory the document's pool took, as
+  the object's allocstats message does.
+
+  Build and run from this directory, e.g.:
+    c++ -O2 -std=c++11 -I../rapidxml parse_bench.cpp -o parse_bench
+    ./parse_bench [file.musicxml]
+
+  Add -DRAPIDXML_STATIC_POOL_SIZE=<bytes> and
+  -DRAPIDXML_DYNAMIC_POOL_SIZE=<bytes> to try other pool sizes.
+*/
+
+#include "rapidxml.hpp"
+#include "rapidxml_arena.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace rapidxml;
+
+static std::string synthesize(int nparts, int nmeasures)
+{
+    static const char *steps[] = {"C", "D", "E", "F", "G", "A", "B"};
+    std::ostringstream s;
+    s << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      << "<score-partwise version=\"4.0\">\n";
+    for(int p = 0; p < nparts; ++p)
+    {
+        s << "\t<part id=\"P" << p + 1 << "\">\n";
+        for(int m = 0; m < nmeasures; ++m)
+        {
+            s << "\t\t<measure number=\"" << m + 1 << "\">\n";
+            for(int k = 0; k < 4; ++k)
+            {
+                s << "\t\t\t<note default-x=\"83.17\">\n"
+                  << "\t\t\t\t<pitch>\n"
+                  << "\t\t\t\t\t<step>" << steps[(m + k) % 7] << "</step>\n"
+                  << "\t\t\t\t\t<octave>4</octave>\n"
+                  << "\t\t\t\t</pitch>\n"
+                  << "\t\t\t\t<duration>1</duration>\n"
+                  << "\t\t\t\t<voice>1</voice>\n"
+                  << "\t\t\t\t<type>quarter</type>\n"
+                  << "\t\t\t\t<lyric><text> Tom &amp; Jerry </text></lyric>\n"
+                  << "\t\t\t</note>\n";
+            }
+            s << "\t\t</measure>\n";
+        }
+        s << "\t</part>\n";
+    }
+    s << "</score-partwise>\n";
+    return s.str();
+}
+
+template<int Flags>
+static double time_parse(const std::string &text, int reps)
+{
+    std::vector<char> buf(text.size() + 1);
+    xml_document<> *doc = new xml_document<>;
+    double best = 1e300;
+    for(int i = 0; i < reps; ++i)
+    {
+        // parsing is destructive, so start from a fresh copy each time
+        memcpy(&buf[0], text.c_str(), text.size() + 1);
+        doc->clear();
+        std::chrono::steady_clock::time_point t0 =
+            std::chrono::steady_clock::now();
+        doc->parse<Flags>(&buf[0]);
+        double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - t0).count();
+        if(ms < best)
+        {
+            best = ms;
+        }
+    }
+    delete doc;
+    return best;
+}
+
+// Parses text with the default flags through a tracked_arena and
+// prints what the pool took and how much of it was used
+static void report_pool(const std::string &text)
+{
+    std::vector<char> buf(text.c_str(), text.c_str() + text.size() + 1);
+    tracked_arena arena;
+    xml_document<> *doc = new xml_document<>;
+    tracked_arena::track(*doc);
+    {
+        tracked_arena::scope scope(&arena);
+        doc->parse<0>(&buf[0]);
+    }
+    arena.record(*doc);
+    const size_t total = RAPIDXML_STATIC_POOL_SIZE + arena.bytes();
+    printf("pool: %d static bytes, %zu blocks of at least %d bytes, "
+           "%zu bytes in all, peak %zu\n",
+           (int)RAPIDXML_STATIC_POOL_SIZE, arena.blocks(),
+           (int)RAPIDXML_DYNAMIC_POOL_SIZE, arena.bytes(), arena.peak());
+    printf("      %zu bytes allocated, %zu of alignment padding, "
+           "%zu unused\n",
+           arena.allocated(), arena.padding(),
+           total - arena.allocated() - arena.padding());
+    delete doc;
+}
+
+int main(int argc, char **argv)
+{
+    std::string text;
+    if(argc > 1)
+    {
+        std::ifstream f(argv[1], std::ios::binary);
+        if(!f)
+        {
+            printf("couldn't open %s\n", argv[1]);
+            return 1;
+        }
+        std::ostringstream s;
+        s << f.rdbuf();
+        text = s.str();
+    }
+    else
+    {
+        text = synthesize(16, 1000);
+    }
+    const int reps = 5;
+    printf("%zu bytes\n", text.size());
+    printf("default:          %8.2f ms\n", time_parse<0>(text, reps));
+    printf("noentity:         %8.2f ms\n",
+           time_parse<parse_no_entity_translation>(text, reps));
+    printf("trim:             %8.2f ms\n",
+           time_parse<parse_trim_whitespace>(text, reps));
+    printf("noentity trim:    %8.2f ms\n",
+           time_parse<parse_no_entity_translation
+                      | parse_trim_whitespace>(text, reps));
+    printf("normalize:        %8.2f ms\n",
+           time_parse<parse_normalize_whitespace>(text, reps));
+    printf("comments:         %8.2f ms\n",
+           time_parse<parse_comment_nodes>(text, reps));
+    report_pool(text);
+    return 0;
+}
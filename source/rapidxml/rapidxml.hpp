@@ -131,6 +131,16 @@ namespace rapidxml
     #define RAPIDXML_ALIGNMENT sizeof(void *)
 #endif
 
+///////////////////////////////////////////////////////////////////////////
+// Nesting depth
+
+#ifndef RAPIDXML_MAX_DEPTH
+    // Deepest nesting of elements the parser accepts.
+    // Define RAPIDXML_MAX_DEPTH before including rapidxml.hpp if you want to override the default value.
+    // The parser recurses once per level, so deeper documents are rejected with parse_error rather than overflowing the stack.
+    #define RAPIDXML_MAX_DEPTH 256
+#endif
+
 namespace rapidxml
 {
     // Forward declarations
@@ -246,6 +256,15 @@ namespace rapidxml
     //! See xml_document::parse() function.
     const int parse_normalize_whitespace = 0x800;
 
+    //! Parse flag instructing the parser to store the attributes of each element in one contiguous array.
+    //! They remain linked, so first_attribute() and next_attribute() work as usual, 
+    //! and xml_node::contiguous_attribute_count() tells how many can be indexed from first_attribute().
+    //! By default, attributes are allocated one by one and are only contiguous when they happen to be.
+    //! Can be combined with other flags by use of | operator.
+    //! <br><br>
+    //! See xml_document::parse() function.
+    const int parse_contiguous_attributes = 0x1000;
+
     // Compound flags
     
     //! Parse flags which represent default behaviour of the parser. 
@@ -466,6 +485,22 @@ namespace rapidxml
             return attribute;
         }
 
+        //! Allocates an array of empty attributes from the pool.
+        //! If the allocation request cannot be accomodated, this function will throw <code>std::bad_alloc</code>.
+        //! If exceptions are disabled by defining RAPIDXML_NO_EXCEPTIONS, this function
+        //! will call rapidxml::parse_error_handler() function.
+        //! \param count Number of attributes to allocate; must be greater than 0.
+        //! \return Pointer to first allocated attribute. This pointer will never be NULL.
+        xml_attribute<Ch> *allocate_attributes(std::size_t count)
+        {
+            assert(count > 0);
+            void *memory = allocate_aligned(count * sizeof(xml_attribute<Ch>));
+            xml_attribute<Ch> *attributes = static_cast<xml_attribute<Ch> *>(memory);
+            for (std::size_t i = 0; i < count; ++i)
+                new(attributes + i) xml_attribute<Ch>;
+            return attributes;
+        }
+
         //! Allocates a char array of given size from the pool, and optionally copies a given string to it.
         //! If the allocation request cannot be accomodated, this function will throw <code>std::bad_alloc</code>.
         //! If exceptions are disabled by defining RAPIDXML_NO_EXCEPTIONS, this function
@@ -556,6 +591,21 @@ namespace rapidxml
             m_free_func = ff;
         }
 
+        //! Gets the number of bytes handed out by the pool since it was constructed or last cleared,
+        //! not counting alignment padding.
+        //! \return Number of bytes allocated from the pool.
+        std::size_t allocated() const
+        {
+            return m_allocated;
+        }
+
+        //! Gets the number of bytes the pool skipped to align blocks and allocations since it was constructed or last cleared.
+        //! \return Number of bytes lost to alignment.
+        std::size_t padding() const
+        {
+            return m_padding;
+        }
+
     private:
 
         struct header
@@ -568,6 +618,8 @@ namespace rapidxml
             m_begin = m_static_memory;
             m_ptr = align(m_begin);
             m_end = m_static_memory + sizeof(m_static_memory);
+            m_allocated = 0;
+            m_padding = m_ptr - m_begin;
         }
         
         char *align(char *ptr)
@@ -620,12 +672,15 @@ namespace rapidxml
                 m_begin = raw_memory;
                 m_ptr = pool + sizeof(header);
                 m_end = raw_memory + alloc_size;
+                m_padding += pool - raw_memory;
 
                 // Calculate aligned pointer again using new pool
                 result = align(m_ptr);
             }
 
             // Update pool and return aligned pointer
+            m_padding += result - m_ptr;
+            m_allocated += size;
             m_ptr = result + size;
             return result;
         }
@@ -633,6 +688,8 @@ namespace rapidxml
         char *m_begin;                                      // Start of raw memory making up current pool
         char *m_ptr;                                        // First free byte in current pool
         char *m_end;                                        // One past last available byte in current pool
+        std::size_t m_allocated;                            // Bytes handed out since last cleared
+        std::size_t m_padding;                              // Bytes skipped for alignment since last cleared
         char m_static_memory[RAPIDXML_STATIC_POOL_SIZE];    // Static raw memory
         alloc_func *m_alloc_func;                           // Allocator function, or 0 if default is to be used
         free_func *m_free_func;                             // Free function, or 0 if default is to be used
@@ -890,6 +947,8 @@ namespace rapidxml
     class xml_node: public xml_base<Ch>
     {
 
+        friend class xml_document<Ch>;
+
     public:
 
         ///////////////////////////////////////////////////////////////////////////
@@ -902,6 +961,7 @@ namespace rapidxml
             : m_type(type)
             , m_first_node(0)
             , m_first_attribute(0)
+            , m_attribute_count(0)
         {
         }
 
@@ -1057,6 +1117,16 @@ namespace rapidxml
                 return m_first_attribute ? m_last_attribute : 0;
         }
 
+        //! Gets number of attributes stored in an array starting at first_attribute(), 
+        //! so that first_attribute()[i] is the i-th attribute.
+        //! This is only known for nodes parsed with rapidxml::parse_contiguous_attributes 
+        //! and whose attributes have not been modified since; otherwise it is 0.
+        //! \return Number of contiguous attributes, or 0 if not known.
+        std::size_t contiguous_attribute_count() const
+        {
+            return m_attribute_count;
+        }
+
         ///////////////////////////////////////////////////////////////////////////
         // Node modification
     
@@ -1197,6 +1267,7 @@ namespace rapidxml
         void prepend_attribute(xml_attribute<Ch> *attribute)
         {
             assert(attribute && !attribute->parent());
+            m_attribute_count = 0;
             if (first_attribute())
             {
                 attribute->m_next_attribute = m_first_attribute;
@@ -1217,6 +1288,7 @@ namespace rapidxml
         void append_attribute(xml_attribute<Ch> *attribute)
         {
             assert(attribute && !attribute->parent());
+            m_attribute_count = 0;
             if (first_attribute())
             {
                 attribute->m_prev_attribute = m_last_attribute;
@@ -1240,6 +1312,7 @@ namespace rapidxml
         {
             assert(!where || where->parent() == this);
             assert(attribute && !attribute->parent());
+            m_attribute_count = 0;
             if (where == m_first_attribute)
                 prepend_attribute(attribute);
             else if (where == 0)
@@ -1260,6 +1333,7 @@ namespace rapidxml
         void remove_first_attribute()
         {
             assert(first_attribute());
+            m_attribute_count = 0;
             xml_attribute<Ch> *attribute = m_first_attribute;
             if (attribute->m_next_attribute)
             {
@@ -1277,6 +1351,7 @@ namespace rapidxml
         void remove_last_attribute()
         {
             assert(first_attribute());
+            m_attribute_count = 0;
             xml_attribute<Ch> *attribute = m_last_attribute;
             if (attribute->m_prev_attribute)
             {
@@ -1293,6 +1368,7 @@ namespace rapidxml
         void remove_attribute(xml_attribute<Ch> *where)
         {
             assert(first_attribute() && where->parent() == this);
+            m_attribute_count = 0;
             if (where == m_first_attribute)
                 remove_first_attribute();
             else if (where == m_last_attribute)
@@ -1308,6 +1384,7 @@ namespace rapidxml
         //! Removes all attributes of node.
         void remove_all_attributes()
         {
+            m_attribute_count = 0;
             for (xml_attribute<Ch> *attribute = first_attribute(); attribute; attribute = attribute->m_next_attribute)
                 attribute->m_parent = 0;
             m_first_attribute = 0;
@@ -1339,6 +1416,7 @@ namespace rapidxml
         xml_node<Ch> *m_last_node;              // Pointer to last child node, or 0 if none; this value is only valid if m_first_node is non-zero
         xml_attribute<Ch> *m_first_attribute;   // Pointer to first attribute of node, or 0 if none; always valid
         xml_attribute<Ch> *m_last_attribute;    // Pointer to last attribute of node, or 0 if none; this value is only valid if m_first_attribute is non-zero
+        std::size_t m_attribute_count;          // Number of attributes in an array starting at m_first_attribute, or 0 if not known; always valid
         xml_node<Ch> *m_prev_sibling;           // Pointer to previous sibling of node, or 0 if none; this value is only valid if m_parent is non-zero
         xml_node<Ch> *m_next_sibling;           // Pointer to next sibling of node, or 0 if none; this value is only valid if m_parent is non-zero
 
@@ -1363,6 +1441,7 @@ namespace rapidxml
         //! Constructs empty XML document
         xml_document()
             : xml_node<Ch>(node_document)
+            , m_depth(0)
         {
         }
 
@@ -1376,6 +1455,7 @@ namespace rapidxml
         //! <br><br>
         //! Document can be parsed into multiple times. 
         //! Each new call to parse removes previous nodes and attributes (if any), but does not clear memory pool.
+        //! Elements nested more than <code>RAPIDXML_MAX_DEPTH</code> deep are a parse error.
         //! \param text XML data to parse; pointer is non-const to denote fact that this data may be modified by the parser.
         template<int Flags>
         void parse(Ch *text)
@@ -1385,6 +1465,7 @@ namespace rapidxml
             // Remove current contents
             this->remove_all_nodes();
             this->remove_all_attributes();
+            m_depth = 0;
             
             // Parse BOM, if any
             parse_bom<Flags>(text);
@@ -2056,7 +2137,11 @@ namespace rapidxml
             if (*text == Ch('>'))
             {
                 ++text;
+                // Left too high by an error, but reset by the next parse
+                if (++m_depth > RAPIDXML_MAX_DEPTH)
+                    RAPIDXML_PARSE_ERROR("elements nested too deeply", text);
                 parse_node_contents<Flags>(text, element);
+                --m_depth;
             }
             else if (*text == Ch('/'))
             {
@@ -2236,6 +2321,11 @@ namespace rapidxml
         template<int Flags>
         void parse_node_attributes(Ch *&text, xml_node<Ch> *node)
         {
+            // Attributes allocated one after another are adjacent unless the pool had to start a new block
+            xml_attribute<Ch> *first = 0;
+            std::size_t count = 0;
+            bool contiguous = true;
+
             // For all attributes 
             while (attribute_name_pred::test(*text))
             {
@@ -2250,6 +2340,14 @@ namespace rapidxml
                 xml_attribute<Ch> *attribute = this->allocate_attribute();
                 attribute->name(name, text - name);
                 node->append_attribute(attribute);
+                if (Flags & parse_contiguous_attributes)
+                {
+                    if (!first)
+                        first = attribute;
+                    else if (attribute != first + count)
+                        contiguous = false;
+                    ++count;
+                }
 
                 // Skip whitespace after attribute name
                 skip<whitespace_pred, Flags>(text);
@@ -2295,8 +2393,29 @@ namespace rapidxml
                 // Skip whitespace after attribute value
                 skip<whitespace_pred, Flags>(text);
             }
+
+            if ((Flags & parse_contiguous_attributes) && count)
+            {
+                // Move the attributes into one array if they were split across blocks
+                if (!contiguous)
+                {
+                    xml_attribute<Ch> *attributes = this->allocate_attributes(count);
+                    xml_attribute<Ch> *attribute = node->first_attribute();
+                    for (std::size_t i = 0; i < count; ++i, attribute = attribute->next_attribute())
+                    {
+                        attributes[i].name(attribute->name(), attribute->name_size());
+                        attributes[i].value(attribute->value(), attribute->value_size());
+                    }
+                    node->remove_all_attributes();
+                    for (std::size_t i = 0; i < count; ++i)
+                        node->append_attribute(attributes + i);
+                }
+                node->m_attribute_count = count;
+            }
         }
 
+        std::size_t m_depth;    // Number of elements open while parsing
+
     };
 
     //! \cond internal
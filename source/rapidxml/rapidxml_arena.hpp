@@ -0,0 +1,206 @@
+#ifndef RAPIDXML_ARENA_HPP_INCLUDED
+#define RAPIDXML_ARENA_HPP_INCLUDED
+
+// Part of MaxScore.rxml rather than of the RapidXml distribution, under
+// the license at the top of MaxScore.rxml.cpp. RapidXml itself is
+// Copyright (C) 2006, 2009 Marcin Kalicinski, see license.txt.
+//! \file rapidxml_arena.hpp This file contains an allocator for memory_pool that records the memory pools take
+
+#include "rapidxml.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace rapidxml
+{
+
+    //! Allocator for memory_pool that counts the blocks pools take from it, how many bytes they hold, and the most held at once,
+    //! so that <code>RAPIDXML_STATIC_POOL_SIZE</code> and <code>RAPIDXML_DYNAMIC_POOL_SIZE</code> can be sized for real documents.
+    //! A pool uses it once track() is called on the pool; blocks are counted in the arena current on the allocating thread,
+    //! see tracked_arena::scope, and blocks allocated with no arena current are not counted.
+    //! A block is always returned to the arena it was counted in, whichever thread frees it, so the arena must outlive the pools using it.
+    //! Together with memory_pool::allocated() and memory_pool::padding(), stored by record(), this shows how much of the memory taken
+    //! was used, lost to alignment, or left unused at the end of blocks.
+    class tracked_arena
+    {
+
+    public:
+
+        //! Makes an arena current on this thread for the lifetime of the scope.
+        class scope
+        {
+        public:
+
+            //! Makes given arena current
+            //! \param arena Arena to count blocks in, or 0 to not count them.
+            explicit scope(tracked_arena *arena)
+                : m_previous(current())
+            {
+                current() = arena;
+            }
+
+            //! Makes the previously current arena current again
+            ~scope()
+            {
+                current() = m_previous;
+            }
+
+        private:
+
+            scope(const scope &);
+            void operator =(const scope &);
+
+            tracked_arena *m_previous;
+
+        };
+
+        //! Constructs an arena holding no blocks.
+        tracked_arena()
+            : m_blocks(0)
+            , m_bytes(0)
+            , m_live(0)
+            , m_peak(0)
+            , m_allocated(0)
+            , m_padding(0)
+        {
+        }
+
+        //! Makes given pool allocate its blocks through tracked arenas.
+        //! This can only be called when no memory is allocated from the pool yet, see memory_pool::set_allocator().
+        //! \param pool Pool to track.
+        template<class Ch>
+        static void track(memory_pool<Ch> &pool)
+        {
+            pool.set_allocator(&allocate, &release);
+        }
+
+        //! Starts counting again from the blocks held now, as before a new document is built.
+        void reset()
+        {
+            m_blocks = 0;
+            m_bytes = 0;
+            m_peak = m_live.load();
+            m_allocated = 0;
+            m_padding = 0;
+        }
+
+        //! Stores the use a pool made of its memory, to be read by allocated() and padding().
+        //! \param pool Pool whose counts to store.
+        template<class Ch>
+        void record(const memory_pool<Ch> &pool)
+        {
+            m_allocated = pool.allocated();
+            m_padding = pool.padding();
+        }
+
+        //! Gets the number of blocks allocated since the arena was constructed or last reset.
+        std::size_t blocks() const
+        {
+            return m_blocks;
+        }
+
+        //! Gets the number of bytes in the blocks allocated since the arena was constructed or last reset.
+        std::size_t bytes() const
+        {
+            return m_bytes;
+        }
+
+        //! Gets the number of bytes in the blocks held now.
+        std::size_t live() const
+        {
+            return m_live;
+        }
+
+        //! Gets the largest number of bytes held at once since the arena was constructed or last reset.
+        std::size_t peak() const
+        {
+            return m_peak;
+        }
+
+        //! Gets memory_pool::allocated() of the pool last recorded.
+        std::size_t allocated() const
+        {
+            return m_allocated;
+        }
+
+        //! Gets memory_pool::padding() of the pool last recorded.
+        std::size_t padding() const
+        {
+            return m_padding;
+        }
+
+        //! Allocates a block of memory, counting it in the current arena.
+        //! Follows memory_pool allocator rules: it never returns 0, but throws <code>std::bad_alloc</code>,
+        //! or calls rapidxml::parse_error_handler() if exceptions are disabled by defining RAPIDXML_NO_EXCEPTIONS.
+        //! \param size Size of block in bytes.
+        //! \return Pointer to allocated block.
+        static void *allocate(std::size_t size)
+        {
+            header *h = static_cast<header *>(std::malloc(sizeof(header) + size));
+            if (!h)
+            {
+#ifdef RAPIDXML_NO_EXCEPTIONS
+                parse_error_handler("out of memory", 0);
+#else
+                throw std::bad_alloc();
+#endif
+            }
+            h->arena = current();
+            h->size = size;
+            if (h->arena)
+                h->arena->add(size);
+            return h + 1;
+        }
+
+        //! Frees a block allocated with allocate(), removing it from the arena it was counted in.
+        //! \param memory Pointer to block.
+        static void release(void *memory)
+        {
+            header *h = static_cast<header *>(memory) - 1;
+            if (h->arena)
+                h->arena->m_live -= h->size;
+            std::free(h);
+        }
+
+    private:
+
+        // Prefix of each block
+        struct header
+        {
+            tracked_arena *arena;   // Arena the block is counted in, or 0
+            std::size_t size;       // Size requested for the block
+        };
+
+        tracked_arena(const tracked_arena &);
+        void operator =(const tracked_arena &);
+
+        static tracked_arena *&current()
+        {
+            static thread_local tracked_arena *arena = 0;
+            return arena;
+        }
+
+        void add(std::size_t size)
+        {
+            ++m_blocks;
+            m_bytes += size;
+            std::size_t live = m_live += size;
+            std::size_t peak = m_peak;
+            while (live > peak && !m_peak.compare_exchange_weak(peak, live))
+                ;
+        }
+
+        std::atomic<std::size_t> m_blocks;      // Blocks allocated since last reset
+        std::atomic<std::size_t> m_bytes;       // Bytes in them
+        std::atomic<std::size_t> m_live;        // Bytes in blocks held now
+        std::atomic<std::size_t> m_peak;        // Most bytes held at once since last reset
+        std::size_t m_allocated;                // memory_pool::allocated() of the pool last recorded
+        std::size_t m_padding;                  // memory_pool::padding() of the pool last recorded
+
+    };
+
+}
+
+#endif
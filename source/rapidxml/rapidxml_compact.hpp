@@ -0,0 +1,376 @@
+#ifndef RAPIDXML_COMPACT_HPP_INCLUDED
+#define RAPIDXML_COMPACT_HPP_INCLUDED
+
+// Part of MaxScore.rxml rather than of the RapidXml distribution, under
+// the license at the top of MaxScore.rxml.cpp. RapidXml itself is
+// Copyright (C) 2006, 2009 Marcin Kalicinski, see license.txt.
+//! \file rapidxml_compact.hpp This file contains a compact, index-based representation of a parsed document
+
+#include "rapidxml.hpp"
+#include "rapidxml_print.hpp"
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+#if defined(_MSC_VER) && _MSC_VER < 1600
+    typedef unsigned __int32 rapidxml_uint32;
+#else
+    #include <stdint.h>
+    typedef uint32_t rapidxml_uint32;
+#endif
+
+namespace rapidxml
+{
+
+    template<class Ch> class compact_document;
+    template<class Ch> class compact_attribute;
+
+    //! Handle to a node of a compact_document.
+    //! It offers the read-only navigation interface of const xml_node<Ch> *, including operator-> and
+    //! conversion to bool, so code written against node pointers can be instantiated with it unchanged.
+    template<class Ch = char>
+    class compact_node
+    {
+    public:
+
+        //! Constructs a null handle
+        compact_node(): m_doc(0), m_index(0)
+        {
+        }
+
+        //! Constructs a handle to given node of given document
+        compact_node(const compact_document<Ch> *doc, rapidxml_uint32 index): m_doc(doc), m_index(index)
+        {
+        }
+
+        //! Lets handles be used like node pointers
+        const compact_node *operator->() const
+        {
+            return this;
+        }
+
+        //! Tests if handle refers to a node
+        operator const void *() const
+        {
+            return m_doc;
+        }
+
+        //! Gets index of node in its document
+        rapidxml_uint32 index() const
+        {
+            return m_index;
+        }
+
+        node_type type() const { return m_doc->type(m_index); }
+        const Ch *name() const { return m_doc->name(m_index); }
+        std::size_t name_size() const { return m_doc->name_size(m_index); }
+        const Ch *value() const { return m_doc->value(m_index); }
+        std::size_t value_size() const { return m_doc->value_size(m_index); }
+
+        compact_node parent() const { return m_index ? compact_node(m_doc, m_doc->parent(m_index)) : compact_node(); }
+        compact_node first_node() const { return m_doc->handle(m_doc->first_node(m_index)); }
+        compact_node next_sibling() const { return m_doc->handle(m_doc->next_sibling(m_index)); }
+
+        //! Gets first attribute of node; iterate with next_attribute()
+        compact_attribute<Ch> first_attribute() const
+        {
+            return m_doc->first_attribute(m_index);
+        }
+
+    private:
+
+        const compact_document<Ch> *m_doc;
+        rapidxml_uint32 m_index;
+
+    };
+
+    //! Handle to an attribute of a compact_document, with the read interface of const xml_attribute<Ch> *.
+    template<class Ch = char>
+    class compact_attribute
+    {
+    public:
+
+        compact_attribute(): m_doc(0), m_index(0), m_end(0)
+        {
+        }
+
+        compact_attribute(const compact_document<Ch> *doc, rapidxml_uint32 index, rapidxml_uint32 end)
+            : m_doc(index < end ? doc : 0), m_index(index), m_end(end)
+        {
+        }
+
+        const compact_attribute *operator->() const
+        {
+            return this;
+        }
+
+        operator const void *() const
+        {
+            return m_doc;
+        }
+
+        const Ch *name() const { return m_doc->attribute_name(m_index); }
+        std::size_t name_size() const { return m_doc->attribute_name_size(m_index); }
+        const Ch *value() const { return m_doc->attribute_value(m_index); }
+        std::size_t value_size() const { return m_doc->attribute_value_size(m_index); }
+
+        //! Gets next attribute of the same node, or a null handle
+        compact_attribute next_attribute() const
+        {
+            return compact_attribute(m_doc, m_index + 1, m_end);
+        }
+
+    private:
+
+        const compact_document<Ch> *m_doc;
+        rapidxml_uint32 m_index;
+        rapidxml_uint32 m_end;
+
+    };
+
+    //! Read-only copy of a parsed tree, laid out as structure-of-arrays with 32-bit indices.
+    //! <br><br>
+    //! Each node takes about 33 bytes (type, name and value ranges, and parent, first child and
+    //! next sibling indices) and each attribute 16, instead of the roughly 100 and 60 bytes of
+    //! xml_node and xml_attribute on 64-bit systems. Attributes of a node are stored contiguously.
+    //! Names and values are not copied when they lie in the source text passed to build(), which is
+    //! the case for in-situ parsing; that text must then outlive the compact document, but the
+    //! xml_document it was parsed into may be cleared as soon as build() returns.
+    //! <br><br>
+    //! Node 0 is the root passed to build(). Index 0 also serves as the null link, since the root
+    //! is never a child or sibling.
+    template<class Ch = char>
+    class compact_document
+    {
+    public:
+
+        typedef compact_node<Ch> node_handle;
+        typedef compact_attribute<Ch> attribute_handle;
+
+        compact_document(): m_base(0), m_base_size(0)
+        {
+        }
+
+        //! Builds the compact copy of given tree, replacing previous contents.
+        //! \param root Root of the tree, usually an xml_document.
+        //! \param base Source text the tree was parsed from, or 0.
+        //! \param base_size Number of characters in the source text.
+        //! \return false if the tree is too large for 32-bit indices.
+        bool build(const xml_node<Ch> &root, const Ch *base, std::size_t base_size)
+        {
+            clear();
+            if (base_size >= npos)
+                return false;
+            m_base = base;
+            m_base_size = base_size;
+
+            // Preorder walk without recursion; path holds the indices of the
+            // ancestors of the current node, last the previous child at each level
+            std::vector<rapidxml_uint32> path(1, 0), last(1, 0);
+            add(&root, 0);
+            const xml_node<Ch> *node = root.first_node();
+            while (node)
+            {
+                if (m_type.size() >= npos)
+                {
+                    clear();
+                    return false;
+                }
+                rapidxml_uint32 index = add(node, path.back());
+                if (last.back())
+                    m_next_sibling[last.back()] = index;
+                else
+                    m_first_child[path.back()] = index;
+                last.back() = index;
+                if (node->first_node())
+                {
+                    path.push_back(index);
+                    last.push_back(0);
+                    node = node->first_node();
+                    continue;
+                }
+                while (node != &root && !node->next_sibling())
+                {
+                    node = node->parent();
+                    path.pop_back();
+                    last.pop_back();
+                }
+                node = node == &root ? 0 : node->next_sibling();
+            }
+            m_first_attribute.push_back(static_cast<rapidxml_uint32>(m_attribute_name.size()));
+            return true;
+        }
+
+        //! Removes all nodes and attributes
+        void clear()
+        {
+            m_type.clear();
+            m_name.clear(); m_name_size.clear();
+            m_value.clear(); m_value_size.clear();
+            m_parent.clear(); m_first_child.clear(); m_next_sibling.clear();
+            m_first_attribute.clear();
+            m_attribute_name.clear(); m_attribute_name_size.clear();
+            m_attribute_value.clear(); m_attribute_value_size.clear();
+            m_strings.clear();
+            m_base = 0;
+            m_base_size = 0;
+        }
+
+        //! Gets number of nodes, including the root
+        std::size_t size() const
+        {
+            return m_type.size();
+        }
+
+        //! Gets number of bytes used by the node, attribute and string arrays
+        std::size_t memory_size() const
+        {
+            return m_type.capacity()
+                + sizeof(rapidxml_uint32) * (m_name.capacity() + m_name_size.capacity()
+                                              + m_value.capacity() + m_value_size.capacity()
+                                              + m_parent.capacity() + m_first_child.capacity()
+                                              + m_next_sibling.capacity() + m_first_attribute.capacity()
+                                              + m_attribute_name.capacity() + m_attribute_name_size.capacity()
+                                              + m_attribute_value.capacity() + m_attribute_value_size.capacity())
+                + sizeof(Ch) * m_strings.capacity();
+        }
+
+        //! Gets handle to the root node, or a null handle if the document is empty
+        node_handle root() const
+        {
+            return m_type.empty() ? node_handle() : node_handle(this, 0);
+        }
+
+        //! Gets handle to first child of the root
+        node_handle first_node() const
+        {
+            return m_type.empty() ? node_handle() : handle(m_first_child[0]);
+        }
+
+        node_type type(rapidxml_uint32 i) const { return static_cast<node_type>(m_type[i]); }
+        const Ch *name(rapidxml_uint32 i) const { return string(m_name[i]); }
+        std::size_t name_size(rapidxml_uint32 i) const { return m_name_size[i]; }
+        const Ch *value(rapidxml_uint32 i) const { return string(m_value[i]); }
+        std::size_t value_size(rapidxml_uint32 i) const { return m_value_size[i]; }
+        rapidxml_uint32 parent(rapidxml_uint32 i) const { return m_parent[i]; }
+        rapidxml_uint32 first_node(rapidxml_uint32 i) const { return m_first_child[i]; }
+        rapidxml_uint32 next_sibling(rapidxml_uint32 i) const { return m_next_sibling[i]; }
+
+        //! Gets handle to the node with given index, or a null handle for index 0
+        node_handle handle(rapidxml_uint32 i) const
+        {
+            return i ? node_handle(this, i) : node_handle();
+        }
+
+        //! Gets first attribute of given node
+        attribute_handle first_attribute(rapidxml_uint32 i) const
+        {
+            return attribute_handle(this, m_first_attribute[i], m_first_attribute[i + 1]);
+        }
+
+        //! Gets number of attributes of given node
+        std::size_t attribute_count(rapidxml_uint32 i) const
+        {
+            return m_first_attribute[i + 1] - m_first_attribute[i];
+        }
+
+        const Ch *attribute_name(rapidxml_uint32 a) const { return string(m_attribute_name[a]); }
+        std::size_t attribute_name_size(rapidxml_uint32 a) const { return m_attribute_name_size[a]; }
+        const Ch *attribute_value(rapidxml_uint32 a) const { return string(m_attribute_value[a]); }
+        std::size_t attribute_value_size(rapidxml_uint32 a) const { return m_attribute_value_size[a]; }
+
+    private:
+
+        static const rapidxml_uint32 npos = 0xffffffffu;
+
+        // Returns offset of given string: into the source text if it lies there, otherwise
+        // into m_strings past the end of the source text, where a terminated copy is made
+        rapidxml_uint32 offset(const Ch *s, std::size_t size)
+        {
+            if (!size)
+                return npos;
+            if (m_base && s >= m_base && s + size <= m_base + m_base_size)
+                return static_cast<rapidxml_uint32>(s - m_base);
+            std::size_t off = m_base_size + m_strings.size();
+            m_strings.insert(m_strings.end(), s, s + size);
+            m_strings.push_back(Ch('\0'));
+            return static_cast<rapidxml_uint32>(off);
+        }
+
+        const Ch *string(rapidxml_uint32 off) const
+        {
+            static Ch zero = Ch('\0');
+            if (off == npos)
+                return &zero;
+            return off < m_base_size ? m_base + off : &m_strings[off - m_base_size];
+        }
+
+        rapidxml_uint32 add(const xml_node<Ch> *node, rapidxml_uint32 parent)
+        {
+            rapidxml_uint32 index = static_cast<rapidxml_uint32>(m_type.size());
+            m_type.push_back(static_cast<unsigned char>(node->type()));
+            m_name.push_back(offset(node->name(), node->name_size()));
+            m_name_size.push_back(static_cast<rapidxml_uint32>(node->name_size()));
+            m_value.push_back(offset(node->value(), node->value_size()));
+            m_value_size.push_back(static_cast<rapidxml_uint32>(node->value_size()));
+            m_parent.push_back(parent);
+            m_first_child.push_back(0);
+            m_next_sibling.push_back(0);
+            m_first_attribute.push_back(static_cast<rapidxml_uint32>(m_attribute_name.size()));
+            for (const xml_attribute<Ch> *a = node->first_attribute(); a; a = a->next_attribute())
+            {
+                m_attribute_name.push_back(offset(a->name(), a->name_size()));
+                m_attribute_name_size.push_back(static_cast<rapidxml_uint32>(a->name_size()));
+                m_attribute_value.push_back(offset(a->value(), a->value_size()));
+                m_attribute_value_size.push_back(static_cast<rapidxml_uint32>(a->value_size()));
+            }
+            return index;
+        }
+
+        const Ch *m_base;
+        std::size_t m_base_size;
+        std::vector<unsigned char> m_type;
+        std::vector<rapidxml_uint32> m_name, m_name_size, m_value, m_value_size;
+        std::vector<rapidxml_uint32> m_parent, m_first_child, m_next_sibling;
+        std::vector<rapidxml_uint32> m_first_attribute;     // One more than there are nodes
+        std::vector<rapidxml_uint32> m_attribute_name, m_attribute_name_size;
+        std::vector<rapidxml_uint32> m_attribute_value, m_attribute_value_size;
+        std::vector<Ch> m_strings;
+
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Printing
+
+    //! Computes the number of characters print_bulk() produces for given compact document, see measure_print().
+    template<class Ch>
+    inline std::size_t measure_print(const compact_document<Ch> &doc, int flags = 0)
+    {
+        return doc.size() ? internal::measure_node<Ch>(doc.root(), flags, 0) : 0;
+    }
+
+    //! Prints given compact document into a contiguous buffer, producing the same text as printing
+    //! the tree it was built from, see print_bulk().
+    template<class Ch>
+    inline Ch *print_bulk(Ch *out, const compact_document<Ch> &doc, int flags = 0)
+    {
+        return doc.size() ? internal::bulk_print_node(out, doc.root(), flags, 0) : out;
+    }
+
+    //! Prints given compact document into given string, replacing its contents.
+    template<class Ch>
+    inline void print_bulk(std::basic_string<Ch> &s, const compact_document<Ch> &doc, int flags = 0)
+    {
+        s.resize(measure_print(doc, flags));
+        if (!s.empty())
+        {
+            Ch *end = print_bulk(&s[0], doc, flags);
+            assert(end == &s[0] + s.size());
+            (void)end;
+        }
+    }
+
+}
+
+#endif
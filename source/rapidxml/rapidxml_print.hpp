@@ -14,6 +14,21 @@
     #include <iterator>
 #endif
 
+#include <cstring>      // For std::memcpy
+#include <cstddef>      // For std::ptrdiff_t
+#include <string>
+
+// Use SIMD to scan text for characters needing expansion in print_bulk(), unless disabled
+#ifndef RAPIDXML_NO_SIMD
+    #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #include <emmintrin.h>
+        #define RAPIDXML_PRINT_SSE2
+    #elif defined(__ARM_NEON) && defined(__aarch64__)
+        #include <arm_neon.h>
+        #define RAPIDXML_PRINT_NEON
+    #endif
+#endif
+
 namespace rapidxml
 {
 
@@ -28,6 +43,19 @@ namespace rapidxml
     //! \cond internal
     namespace internal
     {
+
+        // Forward declarations of printing operations, which refer to each other
+        template<class OutIt, class Ch> inline OutIt print_open_node(OutIt out, const xml_node<Ch> *node, int flags, int indent);
+        template<class OutIt, class Ch> inline OutIt print_close_node(OutIt out, const xml_node<Ch> *node, int flags, int indent);
+        template<class OutIt, class Ch> inline OutIt print_leaf_node(OutIt out, const xml_node<Ch> *node, int flags, int indent);
+        template<class OutIt, class Ch> inline OutIt print_attributes(OutIt out, const xml_node<Ch> *node, int flags);
+        template<class OutIt, class Ch> inline OutIt print_data_node(OutIt out, const xml_node<Ch> *node, int flags, int indent);
+        template<class OutIt, class Ch> inline OutIt print_cdata_node(OutIt out, const xml_node<Ch> *node, int flags, int indent);
+        template<class OutIt, class Ch> inline OutIt print_element_node(OutIt out, const xml_node<Ch> *node, int flags, int indent);
+        template<class OutIt, class Ch> inline OutIt print_declaration_node(OutIt out, const xml_node<Ch> *node, int flags, int indent);
+        template<class OutIt, class Ch> inline OutIt print_comment_node(OutIt out, const xml_node<Ch> *node, int flags, int indent);
+        template<class OutIt, class Ch> inline OutIt print_doctype_node(OutIt out, const xml_node<Ch> *node, int flags, int indent);
+        template<class OutIt, class Ch> inline OutIt print_pi_node(OutIt out, const xml_node<Ch> *node, int flags, int indent);
         
         ///////////////////////////////////////////////////////////////////////////
         // Internal character operations
@@ -102,19 +130,104 @@ namespace rapidxml
         ///////////////////////////////////////////////////////////////////////////
         // Internal printing operations
     
+        // Test if node is printed as an opening line, its children each on their own lines, and a closing line,
+        // rather than whole; documents and elements with other children than a sole data node are
+        template<class Node>
+        inline bool print_nests(Node node)
+        {
+            if (node->type() == node_document)
+                return true;
+            Node child = node->first_node();
+            return node->type() == node_element && child && (child->next_sibling() || child->type() != node_data);
+        }
+
         // Print node
+        // The tree is walked through first child, next sibling and parent links instead of recursively,
+        // so the depth of the document does not affect the stack
         template<class OutIt, class Ch>
         inline OutIt print_node(OutIt out, const xml_node<Ch> *node, int flags, int indent)
+        {
+            std::size_t depth = 0;     // Number of open nodes below the one printed
+            for (;;)
+            {
+                // Open node and descend to its first child, or print it whole
+                if (print_nests(node))
+                {
+                    out = print_open_node(out, node, flags, indent);
+                    if (node->first_node())
+                    {
+                        if (node->type() == node_element)
+                            ++indent;
+                        node = node->first_node();
+                        ++depth;
+                        continue;
+                    }
+                    out = print_close_node(out, node, flags, indent);
+                }
+                else
+                    out = print_leaf_node(out, node, flags, indent);
+
+                // Close nodes whose last child has been printed, then step to next sibling
+                while (depth && !node->next_sibling())
+                {
+                    node = node->parent();
+                    --depth;
+                    if (node->type() == node_element)
+                        --indent;
+                    out = print_close_node(out, node, flags, indent);
+                }
+                if (!depth)
+                    return out;
+                node = node->next_sibling();
+            }
+        }
+
+        // Print start of a node whose children are printed on their own lines
+        template<class OutIt, class Ch>
+        inline OutIt print_open_node(OutIt out, const xml_node<Ch> *node, int flags, int indent)
+        {
+            if (node->type() == node_element)
+            {
+                if (!(flags & print_no_indenting))
+                    out = fill_chars(out, indent, Ch('\t'));
+                *out = Ch('<'), ++out;
+                out = copy_chars(node->name(), node->name() + node->name_size(), out);
+                out = print_attributes(out, node, flags);
+                *out = Ch('>'), ++out;
+                if (!(flags & print_no_indenting))
+                    *out = Ch('\n'), ++out;
+            }
+            return out;
+        }
+
+        // Print end of a node whose children are printed on their own lines
+        template<class OutIt, class Ch>
+        inline OutIt print_close_node(OutIt out, const xml_node<Ch> *node, int flags, int indent)
+        {
+            if (node->type() == node_element)
+            {
+                if (!(flags & print_no_indenting))
+                    out = fill_chars(out, indent, Ch('\t'));
+                *out = Ch('<'), ++out;
+                *out = Ch('/'), ++out;
+                out = copy_chars(node->name(), node->name() + node->name_size(), out);
+                *out = Ch('>'), ++out;
+            }
+
+            // If indenting not disabled, add line break after node
+            if (!(flags & print_no_indenting))
+                *out = Ch('\n'), ++out;
+            return out;
+        }
+
+        // Print node that is printed whole
+        template<class OutIt, class Ch>
+        inline OutIt print_leaf_node(OutIt out, const xml_node<Ch> *node, int flags, int indent)
         {
             // Print proper node type
             switch (node->type())
             {
 
-            // Document
-            case node_document:
-                out = print_children(out, node, flags, indent);
-                break;
-
             // Element
             case node_element:
                 out = print_element_node(out, node, flags, indent);
@@ -164,15 +277,6 @@ namespace rapidxml
             return out;
         }
         
-        // Print children of the node                               
-        template<class OutIt, class Ch>
-        inline OutIt print_children(OutIt out, const xml_node<Ch> *node, int flags, int indent)
-        {
-            for (xml_node<Ch> *child = node->first_node(); child; child = child->next_sibling())
-                out = print_node(out, child, flags, indent);
-            return out;
-        }
-
         // Print attributes of the node
         template<class OutIt, class Ch>
         inline OutIt print_attributes(OutIt out, const xml_node<Ch> *node, int flags)
@@ -241,7 +345,7 @@ namespace rapidxml
         template<class OutIt, class Ch>
         inline OutIt print_element_node(OutIt out, const xml_node<Ch> *node, int flags, int indent)
         {
-            assert(node->type() == node_element);
+            assert(node->type() == node_element && !print_nests(node));
 
             // Print element name and attributes, if any
             if (!(flags & print_no_indenting))
@@ -274,27 +378,18 @@ namespace rapidxml
                 // Print normal node tag ending
                 *out = Ch('>'), ++out;
 
-                // Test if node contains a single data node only (and no other nodes)
+                // Node contains a single data node only (and no other nodes), see print_nests()
                 xml_node<Ch> *child = node->first_node();
                 if (!child)
                 {
                     // If node has no children, only print its value without indenting
                     out = copy_and_expand_chars(node->value(), node->value() + node->value_size(), Ch(0), out);
                 }
-                else if (child->next_sibling() == 0 && child->type() == node_data)
+                else
                 {
                     // If node has a sole data child, only print its value without indenting
                     out = copy_and_expand_chars(child->value(), child->value() + child->value_size(), Ch(0), out);
                 }
-                else
-                {
-                    // Print all children with full indenting
-                    if (!(flags & print_no_indenting))
-                        *out = Ch('\n'), ++out;
-                    out = print_children(out, node, flags, indent + 1);
-                    if (!(flags & print_no_indenting))
-                        out = fill_chars(out, indent, Ch('\t'));
-                }
 
                 // Print node end
                 *out = Ch('<'), ++out;
@@ -385,6 +480,449 @@ namespace rapidxml
             return out;
         }
 
+        ///////////////////////////////////////////////////////////////////////////
+        // Internal bulk printing operations
+        //
+        // These mirror the printing operations above, but write whole spans
+        // into a contiguous, preallocated character buffer instead of going
+        // through an output iterator one character at a time. The buffer must
+        // be large enough to hold the output; see measure_print().
+        // Node is any handle with the read interface of const xml_node<Ch> *,
+        // such as compact_node<Ch> (see rapidxml_compact.hpp).
+
+        template<class Ch, class Node>
+        inline Ch *bulk_print_node(Ch *out, Node node, int flags, int indent);
+
+        // Copy characters from given range to given buffer
+        template<class Ch>
+        inline Ch *bulk_copy_chars(const Ch *begin, const Ch *end, Ch *out)
+        {
+            std::size_t n = end - begin;
+            std::memcpy(out, begin, n * sizeof(Ch));
+            return out + n;
+        }
+
+        // Copy a null-terminated ASCII literal to given buffer
+        template<class Ch>
+        inline Ch *bulk_copy_literal(Ch *out, const char *literal)
+        {
+            while (*literal)
+                *out++ = Ch(*literal++);
+            return out;
+        }
+
+        // Fill given buffer with repetitions of the same character
+        template<class Ch>
+        inline Ch *bulk_fill_chars(Ch *out, int n, Ch ch)
+        {
+            for (int i = 0; i < n; ++i)
+                out[i] = ch;
+            return out + (n > 0 ? n : 0);
+        }
+
+        // Test if character is one that copy_and_expand_chars() may expand
+        template<class Ch>
+        inline bool is_expandable(Ch ch)
+        {
+            return ch == Ch('<') || ch == Ch('>') || ch == Ch('\'') || ch == Ch('"') || ch == Ch('&');
+        }
+
+        // Find first character in given range that may need expanding, or end
+        template<class Ch>
+        inline const Ch *find_expandable(const Ch *begin, const Ch *end)
+        {
+            while (begin != end && !is_expandable(*begin))
+                ++begin;
+            return begin;
+        }
+
+        // Narrow character version, scanning 16 characters at a time where SIMD is available
+        inline const char *find_expandable(const char *begin, const char *end)
+        {
+#if defined(RAPIDXML_PRINT_SSE2)
+            const __m128i lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>'), apos = _mm_set1_epi8('\''),
+                          quot = _mm_set1_epi8('"'), amp = _mm_set1_epi8('&');
+            while (end - begin >= 16)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+                __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, gt)),
+                                         _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, apos), _mm_cmpeq_epi8(v, quot)),
+                                                      _mm_cmpeq_epi8(v, amp)));
+                int mask = _mm_movemask_epi8(m);
+                if (mask)
+                {
+                    int i = 0;
+                    while (!(mask & 1))
+                        mask >>= 1, ++i;
+                    return begin + i;
+                }
+                begin += 16;
+            }
+#elif defined(RAPIDXML_PRINT_NEON)
+            const uint8x16_t lt = vdupq_n_u8('<'), gt = vdupq_n_u8('>'), apos = vdupq_n_u8('\''),
+                             quot = vdupq_n_u8('"'), amp = vdupq_n_u8('&');
+            while (end - begin >= 16)
+            {
+                uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t *>(begin));
+                uint8x16_t m = vorrq_u8(vorrq_u8(vceqq_u8(v, lt), vceqq_u8(v, gt)),
+                                        vorrq_u8(vorrq_u8(vceqq_u8(v, apos), vceqq_u8(v, quot)), vceqq_u8(v, amp)));
+                if (vmaxvq_u8(m))
+                    break;      // Locate the exact character with the scalar loop below
+                begin += 16;
+            }
+#endif
+            while (begin != end && !is_expandable(*begin))
+                ++begin;
+            return begin;
+        }
+
+        // Copy characters from given range to given buffer and expand
+        // characters into references (&lt; &gt; &apos; &quot; &amp;).
+        // Runs of characters that need no expansion are copied in one go.
+        template<class Ch>
+        inline Ch *bulk_copy_and_expand_chars(const Ch *begin, const Ch *end, Ch noexpand, Ch *out)
+        {
+            while (begin != end)
+            {
+                const Ch *special = find_expandable(begin, end);
+                out = bulk_copy_chars(begin, special, out);
+                if (special == end)
+                    break;
+                if (*special == noexpand)
+                    *out++ = *special;      // No expansion, copy character
+                else
+                    out = copy_and_expand_chars(special, special + 1, noexpand, out);
+                begin = special + 1;
+            }
+            return out;
+        }
+
+        // Print given attribute and the ones following it
+        template<class Ch, class Attribute>
+        inline Ch *bulk_print_attribute_list(Ch *out, Attribute attribute)
+        {
+            for (; attribute; attribute = attribute->next_attribute())
+            {
+                if (attribute->name() && attribute->value())
+                {
+                    const Ch *value = attribute->value(), *value_end = value + attribute->value_size();
+                    *out++ = Ch(' ');
+                    out = bulk_copy_chars(attribute->name(), attribute->name() + attribute->name_size(), out);
+                    *out++ = Ch('=');
+                    // Print attribute value using appropriate quote type
+                    if (find_char<Ch, Ch('"')>(value, value_end))
+                    {
+                        *out++ = Ch('\'');
+                        out = bulk_copy_and_expand_chars(value, value_end, Ch('"'), out);
+                        *out++ = Ch('\'');
+                    }
+                    else
+                    {
+                        *out++ = Ch('"');
+                        out = bulk_copy_and_expand_chars(value, value_end, Ch('\''), out);
+                        *out++ = Ch('"');
+                    }
+                }
+            }
+            return out;
+        }
+
+        // Print attributes of the node
+        template<class Ch, class Node>
+        inline Ch *bulk_print_attributes(Ch *out, Node node)
+        {
+            return bulk_print_attribute_list(out, node->first_attribute());
+        }
+
+        // Print start tag of element node, without its closing '>'
+        template<class Ch, class Node>
+        inline Ch *bulk_print_element_start(Ch *out, Node node, int flags, int indent)
+        {
+            if (!(flags & print_no_indenting))
+                out = bulk_fill_chars(out, indent, Ch('\t'));
+            *out++ = Ch('<');
+            out = bulk_copy_chars(node->name(), node->name() + node->name_size(), out);
+            return bulk_print_attributes(out, node);
+        }
+
+        // Print end tag of element node
+        template<class Ch, class Node>
+        inline Ch *bulk_print_element_end(Ch *out, Node node)
+        {
+            *out++ = Ch('<');
+            *out++ = Ch('/');
+            out = bulk_copy_chars(node->name(), node->name() + node->name_size(), out);
+            *out++ = Ch('>');
+            return out;
+        }
+
+        // Print element node that is printed whole, see print_nests()
+        template<class Ch, class Node>
+        inline Ch *bulk_print_element_node(Ch *out, Node node, int flags, int indent)
+        {
+            assert(node->type() == node_element && !print_nests(node));
+
+            // Print element name and attributes, if any
+            out = bulk_print_element_start(out, node, flags, indent);
+            *out++ = Ch('>');
+
+            // Print the value, or that of a sole data child, without indenting
+            // A childless node with an empty value prints as an empty element, as print_element_node() does
+            Node child = node->first_node();
+            if (!child)
+                out = bulk_copy_and_expand_chars(node->value(), node->value() + node->value_size(), Ch(0), out);
+            else
+                out = bulk_copy_and_expand_chars(child->value(), child->value() + child->value_size(), Ch(0), out);
+
+            // Print node end
+            return bulk_print_element_end(out, node);
+        }
+
+        // Print node that is printed whole
+        template<class Ch, class Node>
+        inline Ch *bulk_print_leaf_node(Ch *out, Node node, int flags, int indent)
+        {
+            switch (node->type())
+            {
+
+            // Element
+            case node_element:
+                out = bulk_print_element_node(out, node, flags, indent);
+                break;
+
+            // Data
+            case node_data:
+                if (!(flags & print_no_indenting))
+                    out = bulk_fill_chars(out, indent, Ch('\t'));
+                out = bulk_copy_and_expand_chars(node->value(), node->value() + node->value_size(), Ch(0), out);
+                break;
+
+            // Declaration
+            case node_declaration:
+                if (!(flags & print_no_indenting))
+                    out = bulk_fill_chars(out, indent, Ch('\t'));
+                out = bulk_copy_literal(out, "<?xml");
+                out = bulk_print_attributes(out, node);
+                *out++ = Ch('?'); *out++ = Ch('>');
+                break;
+
+            // CDATA
+            case node_cdata:
+                if (!(flags & print_no_indenting))
+                    out = bulk_fill_chars(out, indent, Ch('\t'));
+                out = bulk_copy_literal(out, "<![CDATA[");
+                out = bulk_copy_chars(node->value(), node->value() + node->value_size(), out);
+                out = bulk_copy_literal(out, "]]>");
+                break;
+
+            // Comment
+            case node_comment:
+                if (!(flags & print_no_indenting))
+                    out = bulk_fill_chars(out, indent, Ch('\t'));
+                out = bulk_copy_literal(out, "<!--");
+                out = bulk_copy_chars(node->value(), node->value() + node->value_size(), out);
+                out = bulk_copy_literal(out, "-->");
+                break;
+
+            // Doctype
+            case node_doctype:
+                if (!(flags & print_no_indenting))
+                    out = bulk_fill_chars(out, indent, Ch('\t'));
+                out = bulk_copy_literal(out, "<!DOCTYPE ");
+                out = bulk_copy_chars(node->value(), node->value() + node->value_size(), out);
+                *out++ = Ch('>');
+                break;
+
+            // Pi
+            case node_pi:
+                if (!(flags & print_no_indenting))
+                    out = bulk_fill_chars(out, indent, Ch('\t'));
+                *out++ = Ch('<'); *out++ = Ch('?');
+                out = bulk_copy_chars(node->name(), node->name() + node->name_size(), out);
+                *out++ = Ch(' ');
+                out = bulk_copy_chars(node->value(), node->value() + node->value_size(), out);
+                *out++ = Ch('?'); *out++ = Ch('>');
+                break;
+
+            // Unknown
+            default:
+                assert(0);
+                break;
+            }
+
+            // If indenting not disabled, add line break after node
+            if (!(flags & print_no_indenting))
+                *out++ = Ch('\n');
+            return out;
+        }
+
+        // Print node, walking the tree iteratively as print_node() does
+        template<class Ch, class Node>
+        inline Ch *bulk_print_node(Ch *out, Node node, int flags, int indent)
+        {
+            const bool indenting = !(flags & print_no_indenting);
+            std::size_t depth = 0;
+            for (;;)
+            {
+                // Open node and descend to its first child, or print it whole
+                if (print_nests(node))
+                {
+                    if (node->type() == node_element)
+                    {
+                        out = bulk_print_element_start(out, node, flags, indent);
+                        *out++ = Ch('>');
+                        if (indenting)
+                            *out++ = Ch('\n');
+                    }
+                    if (node->first_node())
+                    {
+                        if (node->type() == node_element)
+                            ++indent;
+                        node = node->first_node();
+                        ++depth;
+                        continue;
+                    }
+                    if (indenting)
+                        *out++ = Ch('\n');
+                }
+                else
+                    out = bulk_print_leaf_node(out, node, flags, indent);
+
+                // Close nodes whose last child has been printed, then step to next sibling
+                while (depth && !node->next_sibling())
+                {
+                    node = node->parent();
+                    --depth;
+                    if (node->type() == node_element)
+                    {
+                        --indent;
+                        if (indenting)
+                            out = bulk_fill_chars(out, indent, Ch('\t'));
+                        out = bulk_print_element_end(out, node);
+                    }
+                    if (indenting)
+                        *out++ = Ch('\n');
+                }
+                if (!depth)
+                    return out;
+                node = node->next_sibling();
+            }
+        }
+
+        // Measure characters from given range after expanding references, see copy_and_expand_chars()
+        template<class Ch>
+        inline std::size_t measure_expanded(const Ch *begin, const Ch *end, Ch noexpand)
+        {
+            std::size_t size = end - begin;
+            while ((begin = find_expandable(begin, end)) != end)
+            {
+                if (*begin != noexpand)
+                    size += (*begin == Ch('<') || *begin == Ch('>')) ? 3 : (*begin == Ch('&') ? 4 : 5);
+                ++begin;
+            }
+            return size;
+        }
+
+        // Measure given attribute and the ones following it, see print_attributes()
+        template<class Ch, class Attribute>
+        inline std::size_t measure_attribute_list(Attribute attribute)
+        {
+            std::size_t size = 0;
+            for (; attribute; attribute = attribute->next_attribute())
+            {
+                if (attribute->name() && attribute->value())
+                {
+                    const Ch *value = attribute->value(), *value_end = value + attribute->value_size();
+                    Ch noexpand = find_char<Ch, Ch('"')>(value, value_end) ? Ch('"') : Ch('\'');
+                    size += 4 + attribute->name_size() + measure_expanded(value, value_end, noexpand);
+                }
+            }
+            return size;
+        }
+
+        // Measure attributes of the node
+        template<class Ch, class Node>
+        inline std::size_t measure_attributes(Node node)
+        {
+            return measure_attribute_list<Ch>(node->first_attribute());
+        }
+
+        // Measure node that is printed whole, see print_leaf_node()
+        template<class Ch, class Node>
+        inline std::size_t measure_leaf_node(Node node)
+        {
+            switch (node->type())
+            {
+            case node_element:
+            {
+                std::size_t size = 1 + node->name_size() + measure_attributes<Ch>(node) + 1;     // <name attributes>
+                Node child = node->first_node();
+                if (!child)
+                    size += measure_expanded(node->value(), node->value() + node->value_size(), Ch(0));
+                else
+                    size += measure_expanded(child->value(), child->value() + child->value_size(), Ch(0));
+                return size + 2 + node->name_size() + 1;     // </name>
+            }
+            case node_data:
+                return measure_expanded(node->value(), node->value() + node->value_size(), Ch(0));
+            case node_cdata:
+                return 9 + node->value_size() + 3;
+            case node_declaration:
+                return 5 + measure_attributes<Ch>(node) + 2;
+            case node_comment:
+                return 4 + node->value_size() + 3;
+            case node_doctype:
+                return 10 + node->value_size() + 1;
+            case node_pi:
+                return 2 + node->name_size() + 1 + node->value_size() + 2;
+            default:
+                assert(0);
+                return 0;
+            }
+        }
+
+        // Measure node, walking the tree as print_node() does; the result must match what the printing operations produce
+        template<class Ch, class Node>
+        inline std::size_t measure_node(Node node, int flags, int indent)
+        {
+            const bool indenting = !(flags & print_no_indenting);
+            std::size_t size = 0, depth = 0;
+            for (;;)
+            {
+                // Each node ends with a line break, and all but documents are indented
+                if (indenting)
+                    size += 1 + (node->type() != node_document ? indent : 0);
+                if (print_nests(node))
+                {
+                    // <name attributes>, line break, and the indented </name> once the children are done
+                    if (node->type() == node_element)
+                        size += 1 + node->name_size() + measure_attributes<Ch>(node) + 1 + (indenting ? 1 + indent : 0) + 2 + node->name_size() + 1;
+                    if (node->first_node())
+                    {
+                        if (node->type() == node_element)
+                            ++indent;
+                        node = node->first_node();
+                        ++depth;
+                        continue;
+                    }
+                }
+                else
+                    size += measure_leaf_node<Ch>(node);
+
+                // Climb from last children, then step to next sibling
+                while (depth && !node->next_sibling())
+                {
+                    node = node->parent();
+                    --depth;
+                    if (node->type() == node_element)
+                        --indent;
+                }
+                if (!depth)
+                    return size;
+                node = node->next_sibling();
+            }
+        }
+
     }
     //! \endcond
 
@@ -402,6 +940,50 @@ namespace rapidxml
         return internal::print_node(out, &node, flags, 0);
     }
 
+    //! Computes the exact number of characters that print() and print_bulk() produce for given node and flags,
+    //! including entity expansion and indentation, without printing anything.
+    //! Use it to allocate the output once and print into it through a pointer, as print_bulk() does.
+    //! Reserving a string for a back_inserter saves little, as appending one character at a time costs about as much as the measuring.
+    //! \param node Node to be measured. Pass xml_document to measure entire document.
+    //! \param flags Flags controlling how XML would be printed.
+    //! \return Number of characters in the printed XML, not counting any terminator.
+    template<class Ch>
+    inline std::size_t measure_print(const xml_node<Ch> &node, int flags = 0)
+    {
+        return internal::measure_node<Ch>(&node, flags, 0);
+    }
+
+    //! Prints XML into given contiguous character buffer.
+    //! Unlike print(), names, values and indentation are written as whole spans rather than one character at a time,
+    //! and text needing no entity expansion is copied with memcpy.
+    //! The buffer must be large enough to hold the output; print_bulk(std::basic_string<Ch> &, ...) sizes it automatically.
+    //! \param out Pointer to buffer to print to.
+    //! \param node Node to be printed. Pass xml_document to print entire document.
+    //! \param flags Flags controlling how XML is printed.
+    //! \return Pointer to position immediately after last character of printed text. No terminator is written.
+    template<class Ch>
+    inline Ch *print_bulk(Ch *out, const xml_node<Ch> &node, int flags = 0)
+    {
+        return internal::bulk_print_node(out, &node, flags, 0);
+    }
+
+    //! Prints XML into given string, replacing its contents.
+    //! The output size is computed by a pre-pass over the tree, so the string is allocated exactly once.
+    //! \param s String to print to.
+    //! \param node Node to be printed. Pass xml_document to print entire document.
+    //! \param flags Flags controlling how XML is printed.
+    template<class Ch>
+    inline void print_bulk(std::basic_string<Ch> &s, const xml_node<Ch> &node, int flags = 0)
+    {
+        s.resize(measure_print(node, flags));
+        if (!s.empty())
+        {
+            Ch *end = print_bulk(&s[0], node, flags);
+            assert(end == &s[0] + s.size());
+            (void)end;
+        }
+    }
+
 #ifndef RAPIDXML_NO_STREAMS
 
     //! Prints XML to given output stream.